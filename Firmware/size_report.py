@@ -0,0 +1,152 @@
+# Prints the flash and RAM used by each part of the firmware after every build, and how much
+# that changed since the last build of the same environment, so size regressions show up
+# before the image stops fitting.
+#
+# The RAM column is static data only. The stack and heap get what is left, see ramwatch.h for
+# how much of that is really used.
+#
+# The sizes come from the symbols of the linked firmware.elf. With LTO a function that was
+# inlined is counted in the module of the function it was inlined into.
+#
+# The build fails if the image doesn't fit the flash the bootloader leaves (upload.maximum_size
+# of the board) or its static data doesn't fit the RAM. That check uses the section sizes, which
+# also count what has no symbol, e.g. the vector table and padding.
+
+Import("env")
+
+import json
+import os
+import re
+import subprocess
+
+#Module of a C++ class
+CLASSES = {
+    "USB": "UHS core",
+    "MAX3421E": "UHS core",
+    "AddressPoolImpl": "UHS core",
+    "UsbDescCache": "UHS core",
+    "USBHub": "UHS hub",
+    "XBOXRECV": "XBOXRECV",
+    "XBOXUSB": "XBOXUSB",
+    "XBOXONE": "XBOXONE",
+    "UsbDriverList": "UHS core",
+    "HardwareSerial": "Arduino core",
+    "Print": "Arduino core",
+    "SPIClass": "Arduino core",
+    "TwoWire": "Wire",
+    "EEPROMClass": "Arduino core",
+}
+
+#Module of everything else, first match wins
+PATTERNS = [
+    ("LUFA", r"^(USB_|Endpoint_|HID_Device_|USB_Device_|EVENT_USB_|Pipe_)"),
+    ("xiddevice", r"(Duke|SteelBattalion|XID|Descriptor|CALLBACK_HID_)"),
+    ("i2clink", r"^(link|crc8)"),
+    ("twimaster", r"^(twi|__vector_36$)"),
+    ("swtimer", r"^(timer|wheel|__vector_32$)"),
+    ("ramwatch", r"^ram(Paint|GetStats)$"),
+    ("config", r"^(config|__vector_30$)"),
+    ("stick", r"^stick"),
+    ("sbmap", r"^(sbMap|applyEntry)"),
+    ("sbfeedback", r"^(sbFeedback|updateRumble|pulseEnded)"),
+    ("hal", r"^hal"),
+    ("Arduino core", r"^(millis|micros|delay|pinMode|digital|analog|init$|main$|Serial|__vector_|timer0_)"),
+    ("libc", r"^(mem|str|__|_exit|abort|atexit|exit)"),
+]
+
+TEXT_TYPES = "TtWwVv"
+
+
+def symbolModule(name):
+    name = re.sub(r"\.(lto_priv|constprop|isra|part)\.\d+.*$", "", name)
+    m = re.match(r"^(?:non-virtual thunk to |vtable for |typeinfo for )?([A-Za-z_][A-Za-z0-9_]*)(?:<.*>)?::", name)
+    if m and m.group(1) in CLASSES:
+        return CLASSES[m.group(1)]
+    for module, pattern in PATTERNS:
+        if re.search(pattern, name):
+            return module
+    return "main"
+
+
+def readSymbols(nm, elf):
+    out = subprocess.check_output([nm, "--print-size", "--size-sort", "--demangle", elf],
+                                  env=env["ENV"]).decode("ascii", "replace")
+    for line in out.splitlines():
+        parts = line.split(" ", 3)
+        if len(parts) == 4:
+            yield parts[3], parts[2], int(parts[1], 16)
+
+
+#Flash and static RAM of the whole image, from its sections
+def imageSize(elf):
+    size = env.subst("$CC").replace("gcc", "size")
+    out = subprocess.check_output([size, "-A", elf], env=env["ENV"]).decode("ascii", "replace")
+    sections = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0].startswith(".") and parts[1].isdigit():
+            sections[parts[0]] = int(parts[1])
+    flash = sections.get(".text", 0) + sections.get(".data", 0)
+    ram = sections.get(".data", 0) + sections.get(".bss", 0) + sections.get(".noinit", 0)
+    return flash, ram
+
+
+def sizeReport(source, target, env):
+    elf = str(target[0])
+    nm = env.subst("$CC").replace("gcc", "nm")
+    modules = {}
+    for name, kind, size in readSymbols(nm, elf):
+        entry = modules.setdefault(symbolModule(name), {"flash": 0, "ram": 0})
+        if kind in TEXT_TYPES:
+            entry["flash"] += size
+        elif kind in "DdBb":
+            entry["ram"] += size
+            if kind in "Dd":
+                entry["flash"] += size #Initial values are copied from flash
+
+    reportPath = os.path.join(env.subst("$BUILD_DIR"), "size_report.json")
+    last = {}
+    if os.path.isfile(reportPath):
+        with open(reportPath) as f:
+            last = json.load(f)
+
+    def delta(now, before):
+        return "%+d" % (now - before) if before is not None and now != before else ""
+
+    print("\nSize by module (%s)" % env.subst("$PIOENV"))
+    print("%-14s %8s %7s %8s %7s" % ("module", "flash", "", "ram", ""))
+    totalFlash = totalRam = 0
+    for module in sorted(modules, key=lambda m: -modules[m]["flash"]):
+        now = modules[module]
+        before = last.get(module, {})
+        print("%-14s %8d %7s %8d %7s" % (module, now["flash"], delta(now["flash"], before.get("flash")),
+                                         now["ram"], delta(now["ram"], before.get("ram"))))
+        totalFlash += now["flash"]
+        totalRam += now["ram"]
+    maxFlash = int(env.BoardConfig().get("upload.maximum_size", 0))
+    maxRam = int(env.BoardConfig().get("upload.maximum_ram_size", 0))
+    print("%-14s %8d %7s %8d" % ("total", totalFlash, "", totalRam))
+    if maxFlash and maxRam:
+        print("%-14s %7d%% %7s %7d%%" % ("of the part", totalFlash * 100 // maxFlash, "",
+                                         totalRam * 100 // maxRam))
+    if maxRam:
+        #What the stack and heap have to share. Compare with freeMin from ramwatch.h at run time.
+        print("%-14s %8s %7s %8d" % ("stack + heap", "", "", maxRam - totalRam))
+
+    with open(reportPath, "w") as f:
+        json.dump(modules, f, indent=1, sort_keys=True)
+
+    flash, ram = imageSize(elf)
+    print("%-14s %8d %7s %8d" % ("image", flash, "", ram))
+    tooBig = []
+    if maxFlash and flash > maxFlash:
+        tooBig.append("flash %d of %d bytes" % (flash, maxFlash))
+    if maxRam and ram > maxRam:
+        tooBig.append("RAM %d of %d bytes" % (ram, maxRam))
+    if tooBig:
+        print("Error: %s doesn't fit, it uses %s" % (env.subst("$PIOENV"), ", ".join(tooBig)))
+        os.remove(elf) #So the next build links and checks it again instead of flashing it
+        env.Exit(1)
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", sizeReport)
@@ -0,0 +1,82 @@
+/*
+ * config.cpp
+ *
+ * Settings kept in EEPROM. See config.h.
+ */
+
+#include "settings.h"
+#ifdef MASTER
+#include <string.h>
+#include "hal.h"
+#include "config.h"
+#include "stick.h"
+
+//Before the versioned image, the Steel Battalion sensitivity was an int32_t at 0x00 and 0x20
+//held 0xAB once it had been written.
+#define CONFIG_OLD_MAGIC_ADDR 0x20
+#define CONFIG_OLD_MAGIC 0xAB
+
+#define CONFIG_IMAGE_SIZE (sizeof(Config_t) + 2)
+
+static_assert(CONFIG_EEPROM_ADDR > CONFIG_OLD_MAGIC_ADDR, "config image overlaps the old settings");
+static_assert(CONFIG_EEPROM_ADDR + CONFIG_IMAGE_SIZE <= HAL_EEPROM_SIZE, "config image doesn't fit the EEPROM");
+
+Config_t config;
+static uint8_t image[CONFIG_IMAGE_SIZE]; //What the EEPROM should hold
+
+//A small radial deadzone hides worn sticks that don't return to centre, the rest is linear.
+#define STICK_DEFAULTS {8, 0, STICK_CURVE_LINEAR, 0}
+
+static const Config_t configDefaults = {
+    400, //sbSensitivity
+    {STICK_DEFAULTS, STICK_DEFAULTS, STICK_DEFAULTS, STICK_DEFAULTS},
+    {}, //sbMap, the built in mapping only
+};
+
+static uint8_t configCrc(const uint8_t *data, uint8_t len)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < len; i++)
+        crc = halCrc8(crc, data[i]);
+    return crc;
+}
+
+void configBegin()
+{
+    halEepromReadBlock(CONFIG_EEPROM_ADDR, image, CONFIG_IMAGE_SIZE);
+    if (image[0] == CONFIG_VERSION && configCrc(image, CONFIG_IMAGE_SIZE - 1) == image[CONFIG_IMAGE_SIZE - 1])
+    {
+        memcpy(&config, &image[1], sizeof(Config_t));
+        return;
+    }
+
+    config = configDefaults;
+    if (halEepromRead(CONFIG_OLD_MAGIC_ADDR) == CONFIG_OLD_MAGIC)
+    {
+        //Keep the sensitivity set with an older firmware. This happens once, so the blocking
+        //write to clear the old marker doesn't matter.
+        int32_t sensitivity;
+        halEepromReadBlock(0x00, &sensitivity, sizeof(sensitivity));
+        if (sensitivity > 0 && sensitivity <= 0xFFFF)
+            config.sbSensitivity = sensitivity;
+        halEepromUpdate(CONFIG_OLD_MAGIC_ADDR, 0xFF);
+    }
+    configSave();
+}
+
+//Start writing config to the EEPROM. Can be called again before the last save has finished,
+//the write then starts over with the new values.
+void configSave()
+{
+    image[0] = CONFIG_VERSION;
+    memcpy(&image[1], &config, sizeof(Config_t));
+    image[CONFIG_IMAGE_SIZE - 1] = configCrc(image, CONFIG_IMAGE_SIZE - 1);
+    halEepromWrite(CONFIG_EEPROM_ADDR, image, CONFIG_IMAGE_SIZE);
+}
+
+//True while a save is in progress. Nothing else may use the EEPROM until it is done.
+bool configBusy()
+{
+    return halEepromBusy();
+}
+#endif
@@ -0,0 +1,56 @@
+/*
+ * config.h
+ *
+ * User settings that survive a power cycle.
+ *
+ * configBegin() loads them from EEPROM into config once at boot, and everything reads them
+ * from RAM after that. To change a setting, write it in config and call configSave(). The
+ * EEPROM is then updated in the background by the EEPROM ready interrupt, one byte per
+ * interrupt and only the bytes that changed, so saving never holds up the main loop.
+ *
+ * The EEPROM image at CONFIG_EEPROM_ADDR is:
+ *   [CONFIG_VERSION] [Config_t] [crc8]
+ * An image with another version or a bad CRC (e.g. power was lost while it was written) is
+ * ignored and the defaults are used.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+#include <inttypes.h>
+#include "settings.h"
+
+#define CONFIG_VERSION 0x53 //Change when Config_t changes
+
+//Stick shaping of one player, see stick.h
+typedef struct
+{
+    uint8_t deadzone;     //Stick travel that reads as centred, in steps of 128
+    uint8_t antiDeadzone; //Smallest output just outside the deadzone, in steps of 128
+    uint8_t curve;        //STICK_CURVE_ response curve
+    uint8_t flags;        //STICK_AXIAL
+} StickConfig_t;
+
+//One input to Steel Battalion button mapping, see sbmap.h
+typedef struct
+{
+    uint8_t input;  //ChatPadButton, or SBMAP_PAD | ButtonEnum. 0 for an unused entry
+    uint8_t flags;  //SBMAP_ layer the entry works in, SBMAP_TOGGLE
+    uint8_t output; //SBMAP_OUT() of the Steel Battalion button, or SBMAP_NONE
+} SbMapEntry_t;
+
+#define SBMAP_OVERRIDES 8 //Mapping entries kept with the settings
+
+typedef struct
+{
+    uint16_t sbSensitivity; //Steel Battalion aiming stick divisor, bigger is slower
+    StickConfig_t stick[MAX_CONTROLLERS];
+    SbMapEntry_t sbMap[SBMAP_OVERRIDES]; //Replace or add to the built in Steel Battalion mapping
+} Config_t;
+
+extern Config_t config;
+
+void configBegin();
+void configSave();
+bool configBusy();
+
+#endif /* CONFIG_H_ */
@@ -0,0 +1,223 @@
+/*
+ * hal.h
+ *
+ * Everything the main loops do with the hardware, behind one set of functions so the logic on
+ * top of them doesn't call the Arduino core, avr-libc, LUFA or the UHS host stack itself: the
+ * time, pins, EEPROM, the USB host side and the controllers on it, the XID device the OG Xbox
+ * sees, the slave I2C and the telemetry output. The master I2C is twimaster.h.
+ *
+ * hal_avr.cpp implements them for the ATmega32U4, twimaster.cpp the master I2C.
+ *
+ * hal_native.cpp implements them on a PC for the master, in virtual time. The controllers, the
+ * OG Xbox and the slaves are simulated and driven by the harness in native/harness.cpp through
+ * the halNative functions at the end of this file. See the native env in platformio.ini.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+#include <inttypes.h>
+#include <string.h>
+#include "settings.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#else
+//Flash and RAM are one address space on a PC
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P memcpy
+#endif
+
+#include "dukecontroller.h"
+#ifdef SUPPORTBATTALION
+#include "steelbattalion.h"
+#endif
+#ifdef MASTER
+#include <xboxEnums.h>
+#endif
+
+#define HAL_INPUT 0
+#define HAL_OUTPUT 1
+#define HAL_INPUT_PULLUP 2
+
+#define HAL_LOW 0
+#define HAL_HIGH 1
+
+#define HAL_EEPROM_SIZE 1024
+
+#define HAL_XID_MAX_PACKET 32 //wMaxPacketSize of the XID OUT endpoints
+
+//XID devices the OG Xbox can see, ConnectedXID
+#define DUKE_CONTROLLER 0
+#define STEELBATTALION 1
+
+/* Power on, before anything else */
+void halBegin();
+
+/* Time */
+uint32_t halMillis();
+uint32_t halMicros();
+void halDelay(uint16_t ms);
+
+/* Pins, numbered as on the Arduino Pro Micro */
+void halPinMode(uint8_t pin, uint8_t mode);
+void halPinWrite(uint8_t pin, uint8_t value);
+uint8_t halPinRead(uint8_t pin);
+
+/* EEPROM. halEepromWrite() writes the bytes of data that differ from the EEPROM in the
+   background, data must stay as it is until halEepromBusy() is false. Calling it again before
+   then starts over. halEepromUpdate() waits for its byte. */
+uint8_t halEepromRead(uint16_t addr);
+void halEepromReadBlock(uint16_t addr, void *data, uint8_t len);
+void halEepromUpdate(uint16_t addr, uint8_t value); //Only written if it differs
+void halEepromWrite(uint16_t addr, const uint8_t *data, uint8_t len);
+bool halEepromBusy();
+
+/* CRC8 (CCITT) of the link frames and the settings */
+static inline uint8_t halCrc8(uint8_t crc, uint8_t data)
+{
+#ifdef __AVR__
+    return _crc8_ccitt_update(crc, data);
+#else
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++)
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    return crc;
+#endif
+}
+
+/* Telemetry output on Serial1 at 500000 baud. text is in flash, e.g. PSTR("..."). */
+void halLogBegin();
+void halLog(const char *text);
+void halLogNum(uint32_t n);
+
+/* XID device, the OG Xbox side. The main loop fills in the reports, xiddevice.c hands them to
+   LUFA and sets enumerationComplete once the OG Xbox has configured the device. */
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    extern USB_XboxGamepad_Data_t XboxOGDuke[MAX_CONTROLLERS];
+#ifdef SUPPORTBATTALION
+    extern USB_XboxSteelBattalion_Data_t XboxOGSteelBattalion;
+    extern USB_XboxSteelBattalion_Feedback_t XboxOGSteelBattalionFeedback;
+#endif
+    extern bool enumerationComplete;
+    extern uint8_t playerID;
+#ifdef __cplusplus
+}
+#endif
+
+void halXidBegin();
+void halXidAttach();
+void halXidDetach();
+void halXidTask(); //Services the control endpoint, call often while attached or enumerating
+
+/* Puts the report of xid (DUKE_CONTROLLER or STEELBATTALION) in the IN endpoint if the OG Xbox
+   has read the last one and 4ms have passed. Returns true if a new report went in. */
+bool halXidReport(uint8_t xid);
+
+/* Slave only. Puts the Duke report in the IN endpoint straight away if the OG Xbox has read the
+   last one, returns false if it hasn't. */
+bool halXidSendReport();
+
+/* If endpoint ep has received a packet, e.g. a rumble or Steel Battalion LED report from the
+   OG Xbox, reads len bytes of it into data and releases it. Returns false if nothing was
+   waiting. len should be the packet size, a shorter packet makes LUFA wait for the next one
+   to fill data. */
+bool halXidReadOut(uint8_t ep, void *data, uint8_t len);
+
+/* Slave side I2C. onReceive is called from the TWI interrupt with the length of each write
+   from the master to address or the general call address, read it with halTwiSlaveRead().
+   halTwiWrite() writes to another device as a bus master and returns true if it was acknowledged.
+   The master itself uses the interrupt driven twimaster.h. */
+void halTwiSlaveBegin(uint8_t address, void (*onReceive)(int len));
+uint8_t halTwiSlaveRead();
+bool halTwiWrite(uint8_t address, const uint8_t *data, uint8_t len);
+
+#ifdef MASTER
+/* USB host side, the MAX3421E and the drivers of this build. halHostBegin() returns false if
+   the host controller didn't answer, call it again. onEnumDelay is called while the stack
+   waits on a device that is still enumerating, onReset is the hard reset of the MAX3421E
+   its fault recovery ends with. */
+typedef struct
+{
+    uint16_t xferOverruns;    //Transfers cut short because they ran out of time
+    uint16_t recoveries;      //Faults the stack recovered from
+    uint16_t lastRecoverTime; //ms the last recovery took
+    uint8_t lastRecoverLevel; //How far the last recovery had to go
+    uint32_t attachTime;      //halMillis() when the last device was plugged in
+    uint16_t lastEnumTime;    //ms the last enumeration took
+    bool lastEnumCached;      //The last enumeration used the descriptor cache
+} HalHostStats_t;
+
+bool halHostBegin(void (*onEnumDelay)(), void (*onReset)());
+void halHostProbe(); //Looks for a device being plugged in or removed
+void halHostTask();
+void halHostGetStats(HalHostStats_t *stats);
+
+/* The controllers on the host side, one pad per player. Wired controllers and the Xbox 360
+   wireless controllers are read the same, only the wireless ones have the button clicks and
+   a chatpad. */
+bool halPadConnected(uint8_t pad);
+bool halPadWireless(uint8_t pad);
+uint8_t halPadButton(ButtonEnum b, uint8_t pad); //0 or 1, 0x00 to 0xFF for L2 and R2
+int16_t halPadHat(AnalogHatEnum a, uint8_t pad);
+bool halPadRumble(uint8_t left, uint8_t right, uint8_t pad); //false if the controller didn't take it
+void halPadLed(LEDEnum led, uint8_t pad);
+void halPadPowerOff(uint8_t pad);
+
+/* Wireless only. A click is a press that hasn't been read by its click function yet. The words
+   are the raw state, see XBOXRECV::getButtonWord() and XBOXRECV::getChatPadWord(). */
+bool halPadButtonClick(ButtonEnum b, uint8_t pad);
+uint16_t halPadButtonWord(uint8_t pad);
+uint8_t halPadChatPad(ChatPadButton b, uint8_t pad);
+uint8_t halPadChatPadClick(ChatPadButton b, uint8_t pad);
+uint32_t halPadChatPadWord(uint8_t pad);
+bool halPadChatPadClicked(uint8_t pad);
+void halPadChatPadLed(uint8_t led, uint8_t pad); //CHATPAD_LED_, queued
+void halPadChatPadInit(uint8_t pad);             //Set the chatpad up again the next time it is polled
+#endif
+
+#ifndef __AVR__
+/* Native only, for the harness. The virtual time moves on by us with halNativeAdvance() and in
+   halDelay(). halXidTask() costs HAL_NATIVE_XID_TASK_US so the boot waits that spin on it end. */
+#define HAL_NATIVE_XID_TASK_US 4
+#define HAL_NATIVE_TWI_ADDRS 4 //The general call address and the slaves
+
+typedef struct
+{
+    bool connected;
+    bool wireless;
+    uint16_t buttons; //XBOX_BUTTONS masks
+    uint8_t l2, r2;
+    int16_t hat[4];   //AnalogHatEnum order
+    uint32_t chatPad; //As XBOXRECV::getChatPadWord()
+} HalNativePad_t;
+
+typedef struct
+{
+    uint32_t reports;        //Reports put in the IN endpoint
+    uint8_t xid;             //Device of the last one
+    uint8_t data[64];        //Last report
+    uint16_t rumbles[MAX_CONTROLLERS];      //Commands the controllers took
+    uint8_t rumble[MAX_CONTROLLERS][2];     //Last left and right
+    uint32_t twiFrames[HAL_NATIVE_TWI_ADDRS]; //Frames written to each address
+    uint8_t twiLast[HAL_NATIVE_TWI_ADDRS][32];
+    uint8_t twiLastLen[HAL_NATIVE_TWI_ADDRS];
+    bool attached;
+} HalNative_t;
+
+extern HalNative_t halNative;
+
+void halNativeAdvance(uint32_t us);
+void halNativeSetPad(uint8_t pad, const HalNativePad_t *state);
+void halNativeXidOut(uint8_t ep, const void *data, uint8_t len); //The OG Xbox writes to an OUT endpoint
+void halNativeTwiReceive(const uint8_t *data, uint8_t len);      //A slave writes to the master
+void halNativeEnumerate(uint16_t ms); //The next halHostTask() waits ms on a device that is enumerating
+#endif
+
+#endif /* HAL_H_ */
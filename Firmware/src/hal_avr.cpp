@@ -0,0 +1,497 @@
+/*
+ * hal_avr.cpp
+ *
+ * Hardware access on the ATmega32U4 with the Arduino core, LUFA and the UHS host stack. See hal.h.
+ */
+
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include "Arduino.h"
+#include "hal.h"
+#include "xiddevice.h"
+#ifdef MASTER
+#include <XBOXRECV.h>
+#include <usbhub.h>
+#include <usbdrivers.h>
+#include <usbdriverslot.h>
+#ifdef SUPPORTWIREDXBOXONE
+#include <XBOXONE.h>
+#endif
+#ifdef SUPPORTWIREDXBOX360
+#include <XBOXUSB.h>
+#endif
+#else
+#include "Wire.h"
+#endif
+
+static_assert(HAL_INPUT == INPUT && HAL_OUTPUT == OUTPUT && HAL_INPUT_PULLUP == INPUT_PULLUP,
+              "HAL pin modes must be the Arduino ones");
+static_assert(HAL_LOW == LOW && HAL_HIGH == HIGH, "HAL pin levels must be the Arduino ones");
+static_assert(HAL_EEPROM_SIZE == E2END + 1, "HAL_EEPROM_SIZE does not match the part");
+
+//The Arduino core's main() is not used, it would attach its own USB device stack.
+int main(void)
+{
+    firmwareBegin();
+    while (1)
+    {
+        firmwareTask();
+    }
+}
+
+void halBegin()
+{
+    //Init the Arduino Library
+    init();
+}
+
+uint32_t halMillis()
+{
+    return millis();
+}
+
+uint32_t halMicros()
+{
+    return micros();
+}
+
+void halDelay(uint16_t ms)
+{
+    delay(ms);
+}
+
+void halPinMode(uint8_t pin, uint8_t mode)
+{
+    pinMode(pin, mode);
+}
+
+void halPinWrite(uint8_t pin, uint8_t value)
+{
+    digitalWrite(pin, value);
+}
+
+uint8_t halPinRead(uint8_t pin)
+{
+    return digitalRead(pin);
+}
+
+/* EEPROM */
+static const uint8_t *eeData;                //What halEepromWrite() is writing
+static uint16_t eeAddr;
+static uint8_t eeLen;
+static volatile uint8_t eePos;               //Next byte the interrupt looks at
+
+uint8_t halEepromRead(uint16_t addr)
+{
+    return eeprom_read_byte((const uint8_t *)addr);
+}
+
+void halEepromReadBlock(uint16_t addr, void *data, uint8_t len)
+{
+    eeprom_read_block(data, (const void *)addr, len);
+}
+
+void halEepromUpdate(uint16_t addr, uint8_t value)
+{
+    eeprom_update_byte((uint8_t *)addr, value);
+}
+
+//Write the next byte of eeData that differs from the EEPROM. Runs each time the EEPROM has
+//finished a write while halEepromWrite() is in progress.
+ISR(EE_READY_vect)
+{
+    while (eePos < eeLen)
+    {
+        uint8_t i = eePos++;
+        EEAR = eeAddr + i;
+        EECR |= _BV(EERE);
+        if (EEDR != eeData[i])
+        {
+            EEDR = eeData[i];
+            EECR |= _BV(EEMPE);
+            EECR |= _BV(EEPE);
+            return;
+        }
+    }
+    EECR &= ~_BV(EERIE); //All written
+}
+
+void halEepromWrite(uint16_t addr, const uint8_t *data, uint8_t len)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        eeData = data;
+        eeAddr = addr;
+        eeLen = len;
+        eePos = 0;
+        EECR |= _BV(EERIE);
+    }
+}
+
+bool halEepromBusy()
+{
+    return (EECR & _BV(EERIE)) || !eeprom_is_ready();
+}
+
+/* Telemetry */
+void halLogBegin()
+{
+    Serial1.begin(500000);
+}
+
+void halLog(const char *text)
+{
+    Serial1.print((const __FlashStringHelper *)text);
+}
+
+void halLogNum(uint32_t n)
+{
+    Serial1.print(n);
+}
+
+/* XID device */
+void halXidBegin()
+{
+    //Init the LUFA USB Device Library
+    SetupHardware();
+    GlobalInterruptEnable();
+}
+
+void halXidAttach()
+{
+    USB_Attach();
+}
+
+void halXidDetach()
+{
+    USB_Detach();
+}
+
+void halXidTask()
+{
+    USB_USBTask();
+}
+
+bool halXidReport(uint8_t xid)
+{
+    USB_ClassInfo_HID_Device_t *hid = &DukeController_HID_Interface;
+#ifdef SUPPORTBATTALION
+    if (xid == STEELBATTALION)
+        hid = &SteelBattalion_HID_Interface;
+#endif
+    if (USB_Device_GetFrameNumber() - hid->State.PrevFrameNum < 4)
+        return false;
+
+    HID_Device_USBTask(hid); //Send OG Xbox HID Report
+    //PrevFrameNum is only updated when the IN endpoint was ready and a report was created
+    return hid->State.PrevFrameNum == USB_Device_GetFrameNumber();
+}
+
+bool halXidSendReport()
+{
+    return DukeController_SendReport();
+}
+
+bool halXidReadOut(uint8_t ep, void *data, uint8_t len)
+{
+    bool received;
+    uint8_t current = Endpoint_GetCurrentEndpoint();
+    Endpoint_SelectEndpoint(ep);
+    received = Endpoint_IsOUTReceived();
+    if (received)
+    {
+        Endpoint_Read_Stream_LE(data, len, NULL);
+        Endpoint_ClearOUT();
+    }
+    Endpoint_SelectEndpoint(current); //set back to the old endpoint.
+    return received;
+}
+
+#ifndef MASTER
+void halTwiSlaveBegin(uint8_t address, void (*onReceive)(int len))
+{
+    Wire.begin(address);
+    Wire.setClock(400000);
+    Wire.onReceive(onReceive);
+    TWAR |= _BV(TWGCE); //Also receive writes to the general call address
+}
+
+uint8_t halTwiSlaveRead()
+{
+    return Wire.read();
+}
+
+bool halTwiWrite(uint8_t address, const uint8_t *data, uint8_t len)
+{
+    Wire.beginTransmission(address);
+    Wire.write(data, len);
+    return Wire.endTransmission(true) == 0;
+}
+#endif
+
+#ifdef MASTER
+/* USB host */
+USB UsbHost;
+USBHub Hub(&UsbHost);
+XBOXRECV Xbox360Wireless(&UsbHost);
+
+//One wired controller per player. The driver is only constructed once a controller is plugged in,
+//so a slot costs the size of the bigger driver instead of one instance of each.
+#if defined(SUPPORTWIREDXBOXONE) && defined(SUPPORTWIREDXBOX360)
+typedef UsbDriverSlot<XBOXONE, XBOXUSB> WiredSlot_t;
+#elif defined(SUPPORTWIREDXBOXONE)
+typedef UsbDriverSlot<XBOXONE> WiredSlot_t;
+#elif defined(SUPPORTWIREDXBOX360)
+typedef UsbDriverSlot<XBOXUSB> WiredSlot_t;
+#endif
+#ifdef WIRED_SLOTS
+WiredSlot_t WiredSlot[WIRED_SLOTS] = {&UsbHost, &UsbHost, &UsbHost, &UsbHost};
+#define WIRED_DRIVERS , WiredSlot_t, WiredSlot_t, WiredSlot_t, WiredSlot_t
+#define WIRED_INSTANCES , &WiredSlot[0], &WiredSlot[1], &WiredSlot[2], &WiredSlot[3]
+#else
+#define WIRED_DRIVERS
+#define WIRED_INSTANCES
+#endif
+
+//The host drivers of this build, polled by UsbHost.Task() without going through their vtables.
+typedef UsbDriverList<USBHub, XBOXRECV WIRED_DRIVERS> HostDrivers_t;
+static constexpr HostDrivers_t hostDrivers(&Hub, &Xbox360Wireless WIRED_INSTANCES);
+static_assert(HostDrivers_t::count == USB_NUMDRIVERS, "USB_NUMDRIVERS in settings.h does not match the host drivers");
+
+static uint8_t pollHostDrivers()
+{
+    return hostDrivers.Poll();
+}
+
+#ifdef SUPPORTWIREDXBOXONE
+//The Xbox One controller of this player, or NULL if it doesn't have one that is ready.
+static XBOXONE *getXboxOneWired(uint8_t controller)
+{
+    XBOXONE *xboxOne = WiredSlot[controller].Get<XBOXONE>();
+    return (xboxOne && xboxOne->XboxOneConnected) ? xboxOne : NULL;
+}
+#endif
+
+#ifdef SUPPORTWIREDXBOX360
+//The wired Xbox 360 controller of this player, or NULL if it doesn't have one that is ready.
+static XBOXUSB *getXbox360Wired(uint8_t controller)
+{
+    XBOXUSB *xbox360 = WiredSlot[controller].Get<XBOXUSB>();
+    return (xbox360 && xbox360->Xbox360Connected) ? xbox360 : NULL;
+}
+#endif
+
+bool halHostBegin(void (*onEnumDelay)(), void (*onReset)())
+{
+    if (UsbHost.Init() == -1)
+        return false;
+
+    UsbHost.attachOnEnumDelay(onEnumDelay);
+    UsbHost.attachOnHostReset(onReset);
+    UsbHost.attachDriverPoll(pollHostDrivers);
+
+    //Init all chatpad led FIFO queues 0xFF means empty spot.
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        Xbox360Wireless.chatPadLedQueue[i][0] = 0xFF;
+        Xbox360Wireless.chatPadLedQueue[i][1] = 0xFF;
+        Xbox360Wireless.chatPadLedQueue[i][2] = 0xFF;
+        Xbox360Wireless.chatPadLedQueue[i][3] = 0xFF;
+        Xbox360Wireless.chatPadInitNeeded[i] = 1;
+    }
+    return true;
+}
+
+void halHostProbe()
+{
+    UsbHost.busprobe();
+}
+
+void halHostTask()
+{
+    UsbHost.Task();
+}
+
+void halHostGetStats(HalHostStats_t *stats)
+{
+    stats->xferOverruns = UsbHost.getXferOverruns();
+    stats->recoveries = UsbHost.getRecoveries();
+    stats->lastRecoverTime = UsbHost.getLastRecoverTime();
+    stats->lastRecoverLevel = UsbHost.getLastRecoverLevel();
+    stats->attachTime = UsbHost.getAttachTime();
+    stats->lastEnumTime = UsbHost.getLastEnumTime();
+    stats->lastEnumCached = UsbHost.isLastEnumCached();
+}
+
+/* Controllers */
+bool halPadConnected(uint8_t pad)
+{
+    if (Xbox360Wireless.Xbox360Connected[pad])
+        return 1;
+
+#ifdef SUPPORTWIREDXBOX360
+    if (getXbox360Wired(pad))
+        return 1;
+#endif
+
+#ifdef SUPPORTWIREDXBOXONE
+    if (getXboxOneWired(pad))
+        return 1;
+#endif
+    return 0;
+}
+
+bool halPadWireless(uint8_t pad)
+{
+    return Xbox360Wireless.Xbox360Connected[pad];
+}
+
+//Parse button presses for each type of controller
+uint8_t halPadButton(ButtonEnum b, uint8_t pad)
+{
+    if (Xbox360Wireless.Xbox360Connected[pad])
+        return Xbox360Wireless.getButtonPress(b, pad);
+
+#ifdef SUPPORTWIREDXBOX360
+    XBOXUSB *xbox360Wired = getXbox360Wired(pad);
+    if (xbox360Wired)
+        return xbox360Wired->getButtonPress(b);
+#endif
+
+#ifdef SUPPORTWIREDXBOXONE
+    XBOXONE *xboxOneWired = getXboxOneWired(pad);
+    if (xboxOneWired)
+    {
+        if (b == L2 || b == R2)
+        {
+            //Xbone one triggers are 10-bit, remove 2LSBs so its 8bit like OG Xbox
+            return (uint8_t)(xboxOneWired->getButtonPress(b) >> 2);
+        }
+        else
+        {
+            return (uint8_t)xboxOneWired->getButtonPress(b);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+//Parse analog stick requests for each type of controller.
+int16_t halPadHat(AnalogHatEnum a, uint8_t pad)
+{
+    if (Xbox360Wireless.Xbox360Connected[pad])
+        return Xbox360Wireless.getAnalogHat(a, pad);
+
+#ifdef SUPPORTWIREDXBOX360
+    XBOXUSB *xbox360Wired = getXbox360Wired(pad);
+    if (xbox360Wired)
+    {
+        int16_t val;
+        val = xbox360Wired->getAnalogHat(a);
+        if (val == -32512) //8bitdo range fix
+            val = -32768;
+        return val;
+    }
+
+#endif
+
+#ifdef SUPPORTWIREDXBOXONE
+    XBOXONE *xboxOneWired = getXboxOneWired(pad);
+    if (xboxOneWired)
+        return xboxOneWired->getAnalogHat(a);
+#endif
+
+    return 0;
+}
+
+//Parse rumble activation requests for each type of controller.
+bool halPadRumble(uint8_t left, uint8_t right, uint8_t pad)
+{
+    bool sent = true;
+    if (Xbox360Wireless.Xbox360Connected[pad])
+        sent = !Xbox360Wireless.setRumbleOn(left, right, pad);
+
+#ifdef SUPPORTWIREDXBOX360
+    XBOXUSB *xbox360Wired = getXbox360Wired(pad);
+    if (xbox360Wired)
+    {
+        sent = !xbox360Wired->setRumbleOn(left, right) && sent;
+    }
+#endif
+
+#ifdef SUPPORTWIREDXBOXONE
+    XBOXONE *xboxOneWired = getXboxOneWired(pad);
+    if (xboxOneWired)
+    {
+        sent = !xboxOneWired->setRumble(left / 8, right / 8, left / 2, right / 2) && sent; //Pulsing rumble becomes one effect
+    }
+#endif
+    return sent;
+}
+
+//Parse LED activation requests for each type of controller.
+void halPadLed(LEDEnum led, uint8_t pad)
+{
+    if (Xbox360Wireless.Xbox360Connected[pad])
+        Xbox360Wireless.setLedOn(led, pad);
+
+#ifdef SUPPORTWIREDXBOX360
+    XBOXUSB *xbox360Wired = getXbox360Wired(pad);
+    if (xbox360Wired)
+        xbox360Wired->setLedOn(led);
+#endif
+
+#ifdef SUPPORTWIREDXBOXONE
+    if (getXboxOneWired(pad))
+    {
+        //no LEDs on Xbox One Controller. I think it is possible to adjust brightness but this is not implemented.
+    }
+#endif
+}
+
+void halPadPowerOff(uint8_t pad)
+{
+    Xbox360Wireless.disconnect(pad);
+}
+
+bool halPadButtonClick(ButtonEnum b, uint8_t pad)
+{
+    return Xbox360Wireless.getButtonClick(b, pad);
+}
+
+uint16_t halPadButtonWord(uint8_t pad)
+{
+    return Xbox360Wireless.getButtonWord(pad);
+}
+
+uint8_t halPadChatPad(ChatPadButton b, uint8_t pad)
+{
+    return Xbox360Wireless.getChatPadPress(b, pad);
+}
+
+uint8_t halPadChatPadClick(ChatPadButton b, uint8_t pad)
+{
+    return Xbox360Wireless.getChatPadClick(b, pad);
+}
+
+uint32_t halPadChatPadWord(uint8_t pad)
+{
+    return Xbox360Wireless.getChatPadWord(pad);
+}
+
+bool halPadChatPadClicked(uint8_t pad)
+{
+    return Xbox360Wireless.getChatPadClicked(pad);
+}
+
+void halPadChatPadLed(uint8_t led, uint8_t pad)
+{
+    Xbox360Wireless.chatPadQueueLed(led, pad);
+}
+
+void halPadChatPadInit(uint8_t pad)
+{
+    Xbox360Wireless.chatPadInitNeeded[pad] = 1;
+}
+#endif
@@ -0,0 +1,483 @@
+/*
+ * hal_native.cpp
+ *
+ * The HAL on a PC, for running the master loop in virtual time. See hal.h.
+ *
+ * Nothing here waits for real. The virtual clock moves on when the harness calls
+ * halNativeAdvance(), in halDelay() and by HAL_NATIVE_XID_TASK_US per halXidTask(). The
+ * controllers are whatever the harness last passed to halNativeSetPad(), the OG Xbox takes a
+ * report every 4ms once attached, and every slave acknowledges what is written to it. The I2C
+ * transfers take their time on a 400kHz bus.
+ */
+
+#ifndef __AVR__
+#include <stdio.h>
+#include "hal.h"
+#include "twimaster.h"
+
+HalNative_t halNative;
+
+static uint64_t now; //us
+
+/* Time */
+void halNativeAdvance(uint32_t us)
+{
+    now += us;
+}
+
+void halBegin()
+{
+}
+
+uint32_t halMillis()
+{
+    return (uint32_t)(now / 1000);
+}
+
+uint32_t halMicros()
+{
+    return (uint32_t)now;
+}
+
+void halDelay(uint16_t ms)
+{
+    now += ms * 1000UL;
+}
+
+/* Pins. Inputs read low, the ID pins of the master are tied to ground. */
+static uint8_t pins[32];
+
+void halPinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void halPinWrite(uint8_t pin, uint8_t value)
+{
+    pins[pin] = value;
+}
+
+uint8_t halPinRead(uint8_t pin)
+{
+    return pins[pin];
+}
+
+/* EEPROM, erased at start. Writes are done straight away. */
+static uint8_t eeprom[HAL_EEPROM_SIZE];
+static bool eepromErased;
+
+static void eepromErase()
+{
+    if (!eepromErased)
+    {
+        memset(eeprom, 0xFF, sizeof(eeprom));
+        eepromErased = true;
+    }
+}
+
+uint8_t halEepromRead(uint16_t addr)
+{
+    eepromErase();
+    return eeprom[addr];
+}
+
+void halEepromReadBlock(uint16_t addr, void *data, uint8_t len)
+{
+    eepromErase();
+    memcpy(data, &eeprom[addr], len);
+}
+
+void halEepromUpdate(uint16_t addr, uint8_t value)
+{
+    eepromErase();
+    eeprom[addr] = value;
+}
+
+void halEepromWrite(uint16_t addr, const uint8_t *data, uint8_t len)
+{
+    eepromErase();
+    memcpy(&eeprom[addr], data, len);
+}
+
+bool halEepromBusy()
+{
+    return false;
+}
+
+/* Telemetry */
+void halLogBegin()
+{
+}
+
+void halLog(const char *text)
+{
+    fputs(text, stdout);
+}
+
+void halLogNum(uint32_t n)
+{
+    printf("%lu", (unsigned long)n);
+}
+
+/* XID device. The OG Xbox configures the device as soon as it is attached. */
+static uint32_t prevFrame;
+static uint8_t outData[3][HAL_XID_MAX_PACKET]; //Waiting on OUT endpoints 1 and 2
+static uint8_t outLen[3];
+
+void halXidBegin()
+{
+}
+
+void halXidAttach()
+{
+    halNative.attached = true;
+    enumerationComplete = true;
+}
+
+void halXidDetach()
+{
+    halNative.attached = false;
+    enumerationComplete = false;
+}
+
+void halXidTask()
+{
+    now += HAL_NATIVE_XID_TASK_US;
+}
+
+bool halXidReport(uint8_t xid)
+{
+    uint32_t frame = halMillis();
+    if (!halNative.attached || frame - prevFrame < 4)
+        return false;
+
+    prevFrame = frame;
+    halNative.reports++;
+    halNative.xid = xid;
+#ifdef SUPPORTBATTALION
+    if (xid == STEELBATTALION)
+        memcpy(halNative.data, &XboxOGSteelBattalion, sizeof(XboxOGSteelBattalion));
+    else
+#endif
+        memcpy(halNative.data, &XboxOGDuke[0], sizeof(XboxOGDuke[0]));
+    return true;
+}
+
+void halNativeXidOut(uint8_t ep, const void *data, uint8_t len)
+{
+    memcpy(outData[ep], data, len);
+    outLen[ep] = len;
+}
+
+bool halXidReadOut(uint8_t ep, void *data, uint8_t len)
+{
+    if (!halNative.attached || outLen[ep] == 0)
+        return false;
+    memcpy(data, outData[ep], len);
+    outLen[ep] = 0;
+    return true;
+}
+
+/* USB host. halNativeEnumerate() makes the next halHostTask() wait on an enumerating device
+   the way the UHS stack does, calling onEnumDelay every ms. */
+static void (*enumDelay)();
+static uint16_t enumPending;
+
+bool halHostBegin(void (*onEnumDelay)(), void (*onReset)())
+{
+    enumDelay = onEnumDelay;
+    return true;
+}
+
+void halHostProbe()
+{
+}
+
+void halNativeEnumerate(uint16_t ms)
+{
+    enumPending = ms;
+}
+
+void halHostTask()
+{
+    uint16_t ms = enumPending;
+    enumPending = 0;
+    for (uint16_t i = 0; i < ms; i++)
+    {
+        now += 1000;
+        enumDelay();
+    }
+}
+
+void halHostGetStats(HalHostStats_t *stats)
+{
+    memset(stats, 0, sizeof(HalHostStats_t));
+}
+
+/* Controllers */
+typedef struct
+{
+    HalNativePad_t state;
+    uint16_t buttonClicks;
+    bool l2Clicked, r2Clicked;
+    uint32_t chatPadClicks;
+} Pad_t;
+
+static Pad_t pads[MAX_CONTROLLERS];
+
+void halNativeSetPad(uint8_t pad, const HalNativePad_t *state)
+{
+    Pad_t *p = &pads[pad];
+    //The same clicks as XBOXRECV takes from an input report that changed something
+    if (state->buttons != p->state.buttons || state->l2 != p->state.l2 || state->r2 != p->state.r2)
+    {
+        p->buttonClicks = state->buttons & ~p->state.buttons;
+        if (p->state.l2 == 0 && state->l2 != 0)
+            p->l2Clicked = true;
+        if (p->state.r2 == 0 && state->r2 != 0)
+            p->r2Clicked = true;
+    }
+    if (state->chatPad != p->state.chatPad)
+        p->chatPadClicks = state->chatPad & ~p->state.chatPad;
+    p->state = *state;
+}
+
+bool halPadConnected(uint8_t pad)
+{
+    return pads[pad].state.connected;
+}
+
+bool halPadWireless(uint8_t pad)
+{
+    return pads[pad].state.connected && pads[pad].state.wireless;
+}
+
+uint8_t halPadButton(ButtonEnum b, uint8_t pad)
+{
+    const HalNativePad_t *s = &pads[pad].state;
+    if (!s->connected)
+        return 0;
+    if (b == L2)
+        return s->l2;
+    if (b == R2)
+        return s->r2;
+    return (s->buttons & pgm_read_word(&XBOX_BUTTONS[(uint8_t)b])) != 0;
+}
+
+int16_t halPadHat(AnalogHatEnum a, uint8_t pad)
+{
+    return pads[pad].state.connected ? pads[pad].state.hat[a] : 0;
+}
+
+bool halPadRumble(uint8_t left, uint8_t right, uint8_t pad)
+{
+    if (pads[pad].state.connected)
+    {
+        halNative.rumbles[pad]++;
+        halNative.rumble[pad][0] = left;
+        halNative.rumble[pad][1] = right;
+    }
+    return true;
+}
+
+void halPadLed(LEDEnum led, uint8_t pad)
+{
+}
+
+void halPadPowerOff(uint8_t pad)
+{
+    pads[pad].state.connected = false;
+}
+
+bool halPadButtonClick(ButtonEnum b, uint8_t pad)
+{
+    Pad_t *p = &pads[pad];
+    if (!halPadWireless(pad))
+        return false;
+
+    bool click;
+    if (b == L2 || b == R2)
+    {
+        bool *clicked = (b == L2) ? &p->l2Clicked : &p->r2Clicked;
+        click = *clicked;
+        *clicked = false;
+        return click;
+    }
+    uint16_t button = pgm_read_word(&XBOX_BUTTONS[(uint8_t)b]);
+    click = p->buttonClicks & button;
+    p->buttonClicks &= ~button;
+    return click;
+}
+
+uint16_t halPadButtonWord(uint8_t pad)
+{
+    return halPadWireless(pad) ? pads[pad].state.buttons : 0;
+}
+
+uint8_t halPadChatPad(ChatPadButton b, uint8_t pad)
+{
+    uint32_t state = halPadChatPadWord(pad);
+    uint8_t button = b;
+    if (button < 17)
+        return ((uint8_t)(state >> 16) & button) != 0;
+    return (uint8_t)(state >> 8) == button || (uint8_t)state == button;
+}
+
+uint8_t halPadChatPadClick(ChatPadButton b, uint8_t pad)
+{
+    uint32_t *clicks = &pads[pad].chatPadClicks;
+    uint8_t button = b;
+    if (!halPadWireless(pad))
+        return 0;
+
+    if (button < 17 && ((uint8_t)(*clicks >> 16) & button))
+    {
+        *clicks &= ~((uint32_t)button << 16);
+        return 1;
+    }
+    if (button >= 17 && (uint8_t)(*clicks >> 8) == button)
+    {
+        *clicks &= 0xFF00FF;
+        return 1;
+    }
+    if (button >= 17 && (uint8_t)*clicks == button)
+    {
+        *clicks &= 0xFFFF00;
+        return 1;
+    }
+    return 0;
+}
+
+uint32_t halPadChatPadWord(uint8_t pad)
+{
+    return halPadWireless(pad) ? pads[pad].state.chatPad : 0;
+}
+
+bool halPadChatPadClicked(uint8_t pad)
+{
+    return halPadWireless(pad) && pads[pad].chatPadClicks != 0;
+}
+
+void halPadChatPadLed(uint8_t led, uint8_t pad)
+{
+}
+
+void halPadChatPadInit(uint8_t pad)
+{
+}
+
+/* Master I2C, see twimaster.h. A transfer is on the bus for 9 bit times per byte plus the
+   address, one after the other, and finishes in the first twiTask() after that. */
+#define TWI_BYTE_US 23 //9 bits at 400kHz
+
+typedef struct
+{
+    uint8_t addr;
+    uint8_t len;
+    bool read;
+    uint64_t queued;
+    uint64_t end;
+    TwiCallback done;
+    uint8_t data[TWI_MAX_DATA];
+} TwiTransfer_t;
+
+static TwiTransfer_t queue[TWI_QUEUE_LEN];
+static uint8_t qHead, qTail;
+static uint64_t busFree;
+static TwiStats_t stats;
+static TwiCallback rxDone;
+static uint8_t rxAddr;
+static uint8_t rxBuffer[TWI_MAX_DATA];
+static uint8_t rxLen;
+
+void twiBegin(uint32_t clock)
+{
+}
+
+void twiListen(uint8_t addr, TwiCallback done)
+{
+    rxAddr = addr;
+    rxDone = done;
+}
+
+static TwiTransfer_t *twiQueue(uint8_t addr, uint8_t len, TwiCallback done)
+{
+    if ((uint8_t)(qHead - qTail) >= TWI_QUEUE_LEN || len == 0 || len > TWI_MAX_DATA)
+    {
+        stats.overflows++;
+        return NULL;
+    }
+    TwiTransfer_t *t = &queue[qHead++ & (TWI_QUEUE_LEN - 1)];
+    t->addr = addr;
+    t->len = len;
+    t->done = done;
+    t->queued = now;
+    t->end = (busFree > now ? busFree : now) + (len + 1) * TWI_BYTE_US;
+    busFree = t->end;
+    stats.depth = qHead - qTail;
+    if (stats.depth > stats.maxDepth)
+        stats.maxDepth = stats.depth;
+    return t;
+}
+
+bool twiWrite(uint8_t addr, const uint8_t *data, uint8_t len, TwiCallback done)
+{
+    TwiTransfer_t *t = twiQueue(addr, len, done);
+    if (t == NULL)
+        return false;
+    t->read = false;
+    memcpy(t->data, data, len);
+    if (addr < HAL_NATIVE_TWI_ADDRS)
+    {
+        halNative.twiFrames[addr]++;
+        memcpy(halNative.twiLast[addr], data, len);
+        halNative.twiLastLen[addr] = len;
+    }
+    return true;
+}
+
+bool twiRead(uint8_t addr, uint8_t len, TwiCallback done)
+{
+    TwiTransfer_t *t = twiQueue(addr, len, done);
+    if (t == NULL)
+        return false;
+    t->read = true;
+    memset(t->data, 0, len);
+    return true;
+}
+
+void twiTask()
+{
+    while (qTail != qHead)
+    {
+        TwiTransfer_t *t = &queue[qTail & (TWI_QUEUE_LEN - 1)];
+        if (t->end > now)
+            break;
+        stats.lastTime = (uint16_t)(t->end - t->queued);
+        if (stats.lastTime > stats.maxTime)
+            stats.maxTime = stats.lastTime;
+        if (t->done != NULL)
+            t->done(t->addr, TWI_OK, t->data, t->len);
+        qTail++;
+    }
+    stats.depth = qHead - qTail;
+
+    if (rxLen != 0)
+    {
+        uint8_t len = rxLen;
+        rxLen = 0;
+        stats.received++;
+        rxDone(rxAddr, TWI_OK, rxBuffer, len);
+    }
+}
+
+TwiStats_t *twiGetStats()
+{
+    return &stats;
+}
+
+void halNativeTwiReceive(const uint8_t *data, uint8_t len)
+{
+    memcpy(rxBuffer, data, len);
+    rxLen = len;
+}
+#endif
@@ -0,0 +1,410 @@
+/*
+ * i2clink.cpp
+ *
+ * Master to slave I2C link protocol. See i2clink.h for the frame format.
+ */
+
+#include <string.h>
+#include "hal.h"
+#include "i2clink.h"
+#ifdef MASTER
+#include "twimaster.h"
+#endif
+
+static uint8_t linkCrc(const uint8_t *data, uint8_t len)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < len; i++)
+    {
+        crc = halCrc8(crc, data[i]);
+    }
+    return crc;
+}
+
+#ifdef MASTER
+#if LINK_MAX_FRAME > TWI_MAX_DATA
+#error "TWI_MAX_DATA is too small for a link frame"
+#endif
+
+#define LINK_TX_RESYNC 0   //The next state has to go in a keyframe
+#define LINK_TX_SYNCED 1   //The slave has the state in lastSent, changes go in delta frames
+#define LINK_TX_DISABLED 2 //The slave is told there is no controller
+
+static const USB_XboxGamepad_Data_t *txSource[MAX_CONTROLLERS];
+static uint8_t lastSent[MAX_CONTROLLERS][LINK_STATE_SIZE];
+static uint8_t txState[MAX_CONTROLLERS];
+static uint32_t keyTimer[MAX_CONTROLLERS];
+static uint8_t txSeq;         //Sequence number of the last delta frame
+static uint32_t disableTimer; //When the disabled slots were last sent
+static bool disableDue;       //A slot was disabled since then
+static uint8_t rumbleEcho[MAX_CONTROLLERS]; //Sequence number of the last rumble frame from each slave
+static bool echoDue;          //A rumble frame came in since the last delta frame
+static LinkStats_t txStats[MAX_CONTROLLERS]; //[LINK_BROADCAST] counts the delta frames
+
+static uint8_t linkMaskWords(uint16_t mask)
+{
+    uint8_t words = 0;
+    for (uint8_t w = 0; w < LINK_STATE_WORDS; w++)
+    {
+        if (mask & (1 << w))
+            words++;
+    }
+    return words;
+}
+
+//Called from twiTask() once a frame has been sent. If a delta frame was not acknowledged no
+//slave got it, so every slave needs a keyframe before it can take deltas again. The disabled
+//slots are sent again LINK_KEYFRAME_INTERVAL later rather than straight away, so the general
+//call isn't repeated on every pass while no slaves are attached.
+static void linkSent(uint8_t addr, uint8_t status, const uint8_t *frame, uint8_t len)
+{
+    if (status != TWI_OK)
+    {
+        txStats[addr].errors++;
+        for (uint8_t i = 1; i < MAX_CONTROLLERS; i++)
+        {
+            if ((addr == LINK_BROADCAST || addr == i) && txState[i] == LINK_TX_SYNCED)
+                txState[i] = LINK_TX_RESYNC;
+        }
+        if (addr == LINK_BROADCAST)
+            disableTimer = halMillis();
+        return;
+    }
+    txStats[addr].bytes += len;
+    txStats[addr].frames++;
+    if ((frame[0] & 0x0F) == LINK_FRAME_KEY)
+        txStats[addr].keyframes++;
+}
+
+//Adds the sequence number and CRC and queues the frame. Returns false if the TWI queue is full,
+//in which case the frame is not sent at all.
+static bool linkTransmit(uint8_t addr, uint8_t *frame, uint8_t len, uint8_t seq)
+{
+    frame[1] = seq;
+    frame[len] = linkCrc(frame, len);
+    return twiWrite(addr, frame, len + 1, linkSent);
+}
+
+//Send the controller state to a slave. A keyframe is sent straight away if one is due,
+//otherwise the changes are sent by linkFlush() in a delta frame shared by all the slaves.
+void linkSendState(uint8_t slave, const USB_XboxGamepad_Data_t *state)
+{
+    const uint8_t *image = (const uint8_t *)state + LINK_STATE_OFFSET;
+    uint8_t frame[2 + LINK_STATE_SIZE + 1];
+
+    txSource[slave] = state;
+    if (txState[slave] == LINK_TX_SYNCED && halMillis() - keyTimer[slave] < LINK_KEYFRAME_INTERVAL)
+        return;
+
+    frame[0] = LINK_HEADER(LINK_FRAME_KEY);
+    memcpy(&frame[2], image, LINK_STATE_SIZE);
+    if (!linkTransmit(slave, frame, 2 + LINK_STATE_SIZE, txSeq))
+        return;
+
+    //Assume the frame gets there, linkSent() falls back to a keyframe if it doesn't.
+    memcpy(lastSent[slave], image, LINK_STATE_SIZE);
+    txState[slave] = LINK_TX_SYNCED;
+    keyTimer[slave] = halMillis();
+}
+
+//Tell a slave there is no controller for it. This goes out in the next delta frame.
+void linkSendDisable(uint8_t slave)
+{
+    txSource[slave] = NULL;
+    if (txState[slave] != LINK_TX_DISABLED)
+    {
+        txState[slave] = LINK_TX_DISABLED;
+        disableDue = true;
+    }
+}
+
+//Send the changes passed to linkSendState() since the last call to all the slaves at once.
+//Call this once per main loop pass, after the controllers have been serviced. The disabled
+//slots are repeated every LINK_KEYFRAME_INTERVAL in case a slave was reset or missed them.
+void linkFlush()
+{
+    uint16_t mask[LINK_SLOTS];
+    bool changed = false;
+
+    for (uint8_t s = 0; s < LINK_SLOTS; s++)
+    {
+        uint8_t slave = s + 1;
+        mask[s] = 0;
+        if (slave >= MAX_CONTROLLERS)
+            continue;
+        if (txState[slave] == LINK_TX_DISABLED && halMillis() - disableTimer >= LINK_KEYFRAME_INTERVAL)
+            disableDue = true;
+        if (txState[slave] != LINK_TX_SYNCED)
+            continue;
+
+        const uint8_t *image = (const uint8_t *)txSource[slave] + LINK_STATE_OFFSET;
+        for (uint8_t w = 0; w < LINK_STATE_WORDS; w++)
+        {
+            if (image[w * 2] != lastSent[slave][w * 2] || image[w * 2 + 1] != lastSent[slave][w * 2 + 1])
+                mask[s] |= (1 << w);
+        }
+        if (mask[s] != 0)
+            changed = true;
+    }
+
+    //One slot always fits in an empty frame, so this sends at most LINK_SLOTS frames.
+    while (changed || disableDue || echoDue)
+    {
+        uint8_t frame[LINK_MAX_FRAME];
+        uint16_t sent[LINK_SLOTS];
+        uint8_t len = 2 + LINK_SLOTS * 2;
+        frame[0] = LINK_HEADER(LINK_FRAME_DELTA);
+        changed = false;
+
+        for (uint8_t s = 0; s < LINK_SLOTS; s++)
+        {
+            uint8_t slave = s + 1;
+            uint16_t slot = 0;
+            sent[s] = 0;
+            if (slave < MAX_CONTROLLERS)
+                slot = (uint16_t)rumbleEcho[slave] << LINK_SLOT_ECHO_SHIFT;
+            if (slave < MAX_CONTROLLERS && txState[slave] == LINK_TX_DISABLED)
+            {
+                slot |= LINK_SLOT_DISABLED;
+            }
+            else if (mask[s] != 0 && len + linkMaskWords(mask[s]) * 2 < LINK_MAX_FRAME)
+            {
+                const uint8_t *image = (const uint8_t *)txSource[slave] + LINK_STATE_OFFSET;
+                for (uint8_t w = 0; w < LINK_STATE_WORDS; w++)
+                {
+                    if (mask[s] & (1 << w))
+                    {
+                        frame[len++] = image[w * 2];
+                        frame[len++] = image[w * 2 + 1];
+                    }
+                }
+                slot |= sent[s] = mask[s];
+                mask[s] = 0;
+            }
+            else if (mask[s] != 0)
+            {
+                changed = true; //Goes in the next frame
+            }
+            frame[2 + s * 2] = slot & 0xFF;
+            frame[3 + s * 2] = slot >> 8;
+        }
+
+        if (!linkTransmit(LINK_BROADCAST, frame, len, txSeq + 1))
+            return; //The changes are still different from lastSent, they go next pass.
+
+        txSeq++;
+        disableDue = false;
+        echoDue = false;
+        disableTimer = halMillis();
+        for (uint8_t s = 0; s < LINK_SLOTS; s++)
+        {
+            if (sent[s] == 0)
+                continue;
+            const uint8_t *image = (const uint8_t *)txSource[s + 1] + LINK_STATE_OFFSET;
+            for (uint8_t w = 0; w < LINK_STATE_WORDS; w++)
+            {
+                if (sent[s] & (1 << w))
+                {
+                    lastSent[s + 1][w * 2] = image[w * 2];
+                    lastSent[s + 1][w * 2 + 1] = image[w * 2 + 1];
+                }
+            }
+        }
+    }
+}
+
+void linkSendPing(uint8_t slave)
+{
+    uint8_t frame[3];
+    frame[0] = LINK_HEADER(LINK_FRAME_PING);
+    linkTransmit(slave, frame, 2, 0);
+}
+
+//Check a rumble frame written to the master by a slave. Returns the address of the slave,
+//or 0 if the frame is bad. Its sequence number is echoed back in the next delta frame.
+uint8_t linkReceiveRumble(const uint8_t *frame, uint8_t len, uint8_t *left, uint8_t *right)
+{
+    if (len != LINK_RUMBLE_SIZE || frame[0] != LINK_HEADER(LINK_FRAME_RUMBLE) ||
+        linkCrc(frame, len - 1) != frame[len - 1] || frame[2] == LINK_BROADCAST || frame[2] >= MAX_CONTROLLERS)
+    {
+        return 0;
+    }
+    *left = frame[3];
+    *right = frame[4];
+    rumbleEcho[frame[2]] = frame[1] & LINK_RUMBLE_SEQ_MASK;
+    echoDue = true;
+    txStats[frame[2]].rumbles++;
+    return frame[2];
+}
+
+//Stats of the frames sent to a slave. LINK_BROADCAST gives the stats of the delta frames.
+LinkStats_t *linkGetStats(uint8_t slave)
+{
+    return &txStats[slave];
+}
+
+#else
+static uint8_t rxSeq;
+static uint8_t rumbleSeq;             //Sequence number of the newest actuator values
+static volatile uint8_t rumbleEchoed; //Sequence number the master last echoed back
+static uint8_t rumbleValues[2];
+static bool rumblePending;            //rumbleValues have not been echoed yet
+static uint32_t rumbleTimer;          //When the rumble frame was last sent
+static bool rxSynced; //A keyframe was received and no frame was lost since
+static LinkStats_t rxStats;
+
+//Check a frame received from the master and apply the part of it for this slave to state.
+//Returns one of LINK_RX_*. A delta frame that can't be applied because a frame before it
+//was lost still returns LINK_RX_STATE, the controller is there even though its state is stale.
+uint8_t linkReceive(uint8_t slave, const uint8_t *frame, uint8_t len, USB_XboxGamepad_Data_t *state)
+{
+    uint8_t *image = (uint8_t *)state + LINK_STATE_OFFSET;
+    uint8_t result;
+
+    if (len < 3 || len > LINK_MAX_FRAME || (frame[0] >> 4) != LINK_VERSION || linkCrc(frame, len - 1) != frame[len - 1])
+    {
+        rxStats.errors++;
+        return LINK_RX_NONE;
+    }
+
+    uint8_t type = frame[0] & 0x0F;
+    uint8_t seq = frame[1];
+    len--; //Drop the CRC
+
+    switch (type)
+    {
+    case LINK_FRAME_KEY:
+        if (len != 2 + LINK_STATE_SIZE)
+        {
+            rxStats.errors++;
+            return LINK_RX_NONE;
+        }
+        memcpy(image, &frame[2], LINK_STATE_SIZE);
+        rxSeq = seq;
+        rxSynced = true;
+        rxStats.keyframes++;
+        result = LINK_RX_STATE;
+        break;
+    case LINK_FRAME_DELTA:
+    {
+        uint16_t mySlot = 0;
+        const uint8_t *word = NULL;
+        uint8_t expected = 2 + LINK_SLOTS * 2;
+        if (len < expected)
+        {
+            rxStats.errors++;
+            return LINK_RX_NONE;
+        }
+        //Find the words for this slave, and check the length against all the slot words.
+        for (uint8_t s = 0; s < LINK_SLOTS; s++)
+        {
+            uint16_t slot = frame[2 + s * 2] | ((uint16_t)frame[3 + s * 2] << 8);
+            uint16_t mask = slot & ((1 << LINK_STATE_WORDS) - 1);
+            if ((slot & ~(mask | LINK_SLOT_ECHO | LINK_SLOT_DISABLED)) != 0)
+            {
+                rxStats.errors++;
+                return LINK_RX_NONE;
+            }
+            if (s + 1 == slave)
+            {
+                mySlot = slot;
+                word = &frame[expected];
+            }
+            for (uint8_t w = 0; w < LINK_STATE_WORDS; w++)
+            {
+                if (mask & (1 << w))
+                    expected += 2;
+            }
+        }
+        if (len != expected)
+        {
+            rxStats.errors++;
+            return LINK_RX_NONE;
+        }
+        rumbleEchoed = (mySlot & LINK_SLOT_ECHO) >> LINK_SLOT_ECHO_SHIFT;
+
+        if (seq != (uint8_t)(rxSeq + 1))
+            rxSynced = false; //A frame was lost, the words that are not in this one may be stale too.
+        rxSeq = seq;
+
+        if (mySlot & LINK_SLOT_DISABLED)
+        {
+            rxSynced = false;
+            result = LINK_RX_DISABLE;
+            break;
+        }
+        result = LINK_RX_STATE;
+        if (!rxSynced)
+        {
+            if (mySlot != 0)
+                rxStats.dropped++;
+            break;
+        }
+        for (uint8_t w = 0; w < LINK_STATE_WORDS; w++)
+        {
+            if (mySlot & (1 << w))
+            {
+                image[w * 2] = *word++;
+                image[w * 2 + 1] = *word++;
+            }
+        }
+        break;
+    }
+    case LINK_FRAME_PING:
+        result = LINK_RX_PING;
+        break;
+    default:
+        rxStats.errors++;
+        return LINK_RX_NONE;
+    }
+
+    rxStats.frames++;
+    rxStats.bytes += len + 1;
+    return result;
+}
+
+//Write the actuator values to the master when they change, or when force is set. Call this every
+//main loop pass. The slave becomes a bus master for this, the TWI hardware sorts out who goes
+//first if the master starts a transfer at the same time. The frame is sent again every
+//LINK_RUMBLE_RETRY until the master has echoed its sequence number in a delta frame.
+void linkPushRumble(uint8_t slave, uint8_t left, uint8_t right, bool force)
+{
+    if (force || left != rumbleValues[0] || right != rumbleValues[1])
+    {
+        rumbleValues[0] = left;
+        rumbleValues[1] = right;
+        rumbleSeq = (rumbleSeq + 1) & LINK_RUMBLE_SEQ_MASK;
+        rumblePending = true;
+        rumbleTimer = halMillis() - LINK_RUMBLE_RETRY; //Send it now
+    }
+    if (!rumblePending)
+        return;
+    if (rumbleEchoed == rumbleSeq)
+    {
+        rumblePending = false;
+        return;
+    }
+    if (halMillis() - rumbleTimer < LINK_RUMBLE_RETRY)
+        return;
+
+    uint8_t frame[LINK_RUMBLE_SIZE];
+    frame[0] = LINK_HEADER(LINK_FRAME_RUMBLE);
+    frame[1] = rumbleSeq;
+    frame[2] = slave;
+    frame[3] = left;
+    frame[4] = right;
+    frame[5] = linkCrc(frame, LINK_RUMBLE_SIZE - 1);
+
+    //If the master did not take it, it is tried again next time round.
+    if (halTwiWrite(LINK_MASTER_ADDR, frame, LINK_RUMBLE_SIZE))
+    {
+        rumbleTimer = halMillis();
+        rxStats.rumbles++;
+    }
+}
+
+LinkStats_t *linkGetStats()
+{
+    return &rxStats;
+}
+#endif
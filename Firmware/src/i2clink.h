@@ -0,0 +1,99 @@
+/*
+ * i2clink.h
+ *
+ * Framed link protocol used by the master to send controller state to the slave devices.
+ *
+ * Every frame is:
+ *   [header] [sequence] [payload...] [crc8]
+ * The header holds LINK_VERSION in the upper nibble and the frame type in the lower nibble.
+ * The CRC8 (CCITT) covers everything before it.
+ *
+ * A keyframe carries the whole state of one player and is sent to the address of its slave.
+ *
+ * A delta frame is sent to the general call address, so one frame updates every slave at the
+ * same instant. Its payload is a 16 bit (little endian) slot word for each of players 2-4,
+ * followed by the changed state words of player 2, then player 3, then player 4. The low bits
+ * of a slot word are a mask of the state words that follow for that player. LINK_SLOT_DISABLED
+ * means there is no controller for that player. LINK_SLOT_ECHO holds the sequence number of the
+ * last rumble frame the master got from that slave. If the changes don't fit in one frame the
+ * rest follow in the next one.
+ *
+ * The sequence number counts delta frames. A keyframe carries the sequence number of the last
+ * delta frame sent before it. A slave only applies a delta frame if it directly follows the
+ * frame before it, otherwise it waits for its next keyframe. Keyframes are sent every
+ * LINK_KEYFRAME_INTERVAL, after a bus error, or when a slave gets a controller.
+ *
+ * The master never polls the slaves. When the OG Xbox changes the rumble of a slave, the slave
+ * takes the bus itself and writes a rumble frame to LINK_MASTER_ADDR:
+ *   [header] [sequence] [slave address] [left actuator] [right actuator] [crc8]
+ * The sequence number goes up by one for every new pair of values. The master echoes it back in
+ * the slave's slot word of the next delta frame. The TWI acknowledge alone is not enough: when
+ * the slave loses arbitration to a general call it is told the write went through although it
+ * was never sent. So the slave sends the frame again every LINK_RUMBLE_RETRY until it sees the
+ * echo.
+ */
+
+#ifndef I2CLINK_H_
+#define I2CLINK_H_
+#include <inttypes.h>
+#include "settings.h"
+#include "dukecontroller.h"
+
+#define LINK_VERSION 4
+
+#define LINK_BROADCAST 0   //TWI general call address, used for delta frames
+#define LINK_MASTER_ADDR 8 //Address the master answers for rumble frames
+
+#define LINK_FRAME_KEY 0x01    //Full controller state of one player
+#define LINK_FRAME_DELTA 0x02  //Changed state words of all the players
+#define LINK_FRAME_PING 0x04   //Sent at power on, the slave flashes its LED
+#define LINK_FRAME_RUMBLE 0x05 //Slave to master, new actuator values
+#define LINK_RUMBLE_SIZE 6
+
+#define LINK_HEADER(type) ((LINK_VERSION << 4) | (type))
+
+//The part of USB_XboxGamepad_Data_t that is sent, dButtons up to rightStickY.
+#define LINK_STATE_OFFSET 2
+#define LINK_STATE_WORDS 9
+#define LINK_STATE_SIZE (LINK_STATE_WORDS * 2)
+
+#define LINK_SLOTS 3               //Players 2-4 in a delta frame
+#define LINK_SLOT_DISABLED 0x8000  //Slot word flag, no controller for this player
+#define LINK_SLOT_ECHO 0x7E00      //Slot word bits with the last rumble sequence number from that slave
+#define LINK_SLOT_ECHO_SHIFT 9
+#define LINK_RUMBLE_SEQ_MASK (LINK_SLOT_ECHO >> LINK_SLOT_ECHO_SHIFT)
+
+#define LINK_MAX_FRAME 32          //Size of the Wire receive buffer on the slave
+#define LINK_KEYFRAME_INTERVAL 100 //ms
+#define LINK_RUMBLE_RETRY 20       //ms a slave waits for the echo of a rumble frame before sending it again
+
+//linkReceive() results
+#define LINK_RX_NONE 0    //Frame rejected
+#define LINK_RX_STATE 1   //The master has a controller for this player
+#define LINK_RX_DISABLE 2 //The master has no controller for this player, the slave detaches from the OG Xbox
+#define LINK_RX_PING 3
+
+typedef struct
+{
+    uint32_t bytes;     //Bytes of good frames
+    uint16_t frames;    //Good frames
+    uint16_t keyframes; //Good keyframes
+    uint16_t errors;    //Master: frames nobody acknowledged. Slave: frames rejected for a bad CRC, version or length
+    uint16_t dropped;   //Slave only: delta frames ignored because a frame before them was lost
+    uint16_t rumbles;   //Rumble frames, received by the master or sent by the slave
+} LinkStats_t;
+
+#ifdef MASTER
+void linkSendState(uint8_t slave, const USB_XboxGamepad_Data_t *state);
+void linkSendDisable(uint8_t slave);
+void linkFlush();
+void linkSendPing(uint8_t slave);
+uint8_t linkReceiveRumble(const uint8_t *frame, uint8_t len, uint8_t *left, uint8_t *right);
+LinkStats_t *linkGetStats(uint8_t slave);
+#else
+uint8_t linkReceive(uint8_t slave, const uint8_t *frame, uint8_t len, USB_XboxGamepad_Data_t *state);
+void linkPushRumble(uint8_t slave, uint8_t left, uint8_t right, bool force);
+LinkStats_t *linkGetStats();
+#endif
+
+#endif /* I2CLINK_H_ */
@@ -22,7 +22,33 @@ static uint8_t usb_error = 0;
 static uint8_t usb_task_state;
 
 /* constructor */
-USB::USB() : bmHubPre(0) {
+USB::USB() : bmHubPre(0),
+bEnumerating(0),
+bInEnumDelay(false),
+pFuncOnEnumDelay(NULL),
+pFuncPollDrivers(NULL),
+pCachedDevice(NULL),
+wConfiguringVID(0),
+wConfiguringPID(0),
+qAttachTime(0),
+lastEnumTime(0),
+bLastEnumCached(false),
+xferStart(0),
+xferBudget(USB_CTRL_BUDGET),
+xferOverruns(0),
+bRecoverLevel(USB_RECOVER_IDLE),
+bRecoverWaiting(false),
+bRecoverParent(0),
+bRecoverPort(0),
+bRecoverLowSpeed(false),
+bHostFault(false),
+bHostTimeouts(0),
+qRecoverTime(0),
+qFaultTime(0),
+recoverCount(0),
+lastRecoverTime(0),
+bLastRecoverLevel(USB_RECOVER_IDLE),
+pFuncOnHostReset(NULL) {
         usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE; //set up state machine
         init();
 }
@@ -124,7 +150,7 @@ uint8_t USB::SetAddress(uint8_t addr, uint8_t ep, EpInfo **ppep, uint16_t *nak_l
 
 /* 01-0f    =   non-zero HRSLT  */
 uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bRequest, uint8_t wValLo, uint8_t wValHi,
-        uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p) {
+        uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p, uint32_t budget) {
         bool direction = false; //request direction, IN or OUT
         uint8_t rcode;
         SETUP_PKT setup_pkt;
@@ -137,6 +163,8 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
         if(rcode)
                 return rcode;
 
+        startXfer(budget);
+
         direction = ((bmReqType & 0x80) > 0);
 
         /* fill in setup packet */
@@ -203,7 +231,7 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
 
 /* rcode 0 if no errors. rcode 01-0f is relayed from dispatchPkt(). Rcode f0 means RCVDAVIRQ error,
             fe USB xfer timeout */
-uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/) {
+uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/, uint32_t budget /*= USB_CTRL_BUDGET*/) {
         EpInfo *pep = NULL;
         uint16_t nak_limit = 0;
 
@@ -215,6 +243,7 @@ uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t*
                 USBTRACE3("(USB::InTransfer) ep requested ", ep, 0x81);
                 return rcode;
         }*/
+        startXfer(budget);
         return InTransfer(pep, nak_limit, nbytesptr, data, bInterval);
 }
 
@@ -290,7 +319,7 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
 /* Handles NAK bug per Maxim Application Note 4000 for single buffer transfer   */
 
 /* rcode 0 if no errors. rcode 01-0f is relayed from HRSL                       */
-uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data) {
+uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, uint32_t budget /*= USB_CTRL_BUDGET*/) {
         EpInfo *pep = NULL;
         uint16_t nak_limit = 0;
 
@@ -299,6 +328,7 @@ uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dat
         if(rcode)
                 return rcode;
 
+        startXfer(budget);
         return OutTransfer(pep, nak_limit, nbytes, data);
 }
 
@@ -313,8 +343,6 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
         if(maxpktsize < 1 || maxpktsize > 64)
                 return USB_ERROR_INVALID_MAX_PKT_SIZE;
 
-        uint32_t timeout = (uint32_t)millis() + USB_XFER_TIMEOUT;
-
         regWr(rHCTL, (pep->bmSndToggle) ? bmSNDTOG1 : bmSNDTOG0); //set toggle value
 
         while(bytes_left) {
@@ -324,11 +352,12 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
                 bytesWr(rSNDFIFO, bytes_tosend, data_p); //filling output FIFO
                 regWr(rSNDBC, bytes_tosend); //set number of bytes
                 regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
-                while(!(regRd(rHIRQ) & bmHXFRDNIRQ)); //wait for the completion IRQ
-                regWr(rHIRQ, bmHXFRDNIRQ); //clear IRQ
+                rcode = waitXferDone(); //wait for the completion IRQ
+                if(rcode)
+                        goto breakout;
                 rcode = (regRd(rHRSL) & 0x0f);
 
-                while(rcode && ((int32_t)((uint32_t)millis() - timeout) < 0L)) {
+                while(rcode && !xferExpired()) {
                         switch(rcode) {
                                 case hrNAK:
                                         nak_count++;
@@ -356,10 +385,15 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
                         regWr(rSNDFIFO, *data_p);
                         regWr(rSNDBC, bytes_tosend);
                         regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
-                        while(!(regRd(rHIRQ) & bmHXFRDNIRQ)); //wait for the completion IRQ
-                        regWr(rHIRQ, bmHXFRDNIRQ); //clear IRQ
+                        rcode = waitXferDone(); //wait for the completion IRQ
+                        if(rcode)
+                                goto breakout;
                         rcode = (regRd(rHRSL) & 0x0f);
                 }//while( rcode && ....
+                if(rcode) { // Ran out of time
+                        xferOverruns++;
+                        goto breakout;
+                }
                 bytes_left -= bytes_tosend;
                 data_p += bytes_tosend;
         }//while( bytes_left...
@@ -370,41 +404,25 @@ breakout:
 }
 /* dispatch USB packet. Assumes peripheral address is set and relevant buffer is loaded/empty       */
 /* If NAK, tries to re-send up to nak_limit times                                                   */
-/* If nak_limit == 0, do not count NAKs, exit after timeout                                         */
+/* If nak_limit == 0, do not count NAKs, exit when the transfer is out of budget                    */
 /* If bus timeout, re-sends up to USB_RETRY_LIMIT times                                             */
+/* The packet is always sent at least once, even if the budget of the transfer is already used up  */
 
 /* return codes 0x00-0x0f are HRSLT( 0x00 being success ), 0xff means timeout                       */
 uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
-        uint32_t timeout = (uint32_t)millis() + USB_XFER_TIMEOUT;
-        uint8_t tmpdata;
         uint8_t rcode = hrSUCCESS;
         uint8_t retry_count = 0;
         uint16_t nak_count = 0;
 
-        while((int32_t)((uint32_t)millis() - timeout) < 0L) {
+        do {
 #if defined(ESP8266) || defined(ESP32)
                         yield(); // needed in order to reset the watchdog timer on the ESP8266
 #endif
                 regWr(rHXFR, (token | ep)); //launch the transfer
-                rcode = USB_ERROR_TRANSFER_TIMEOUT;
-
-                while((int32_t)((uint32_t)millis() - timeout) < 0L) //wait for transfer completion
-                {
-#if defined(ESP8266) || defined(ESP32)
-                        yield(); // needed in order to reset the watchdog timer on the ESP8266
-#endif
-                        tmpdata = regRd(rHIRQ);
-
-                        if(tmpdata & bmHXFRDNIRQ) {
-                                regWr(rHIRQ, bmHXFRDNIRQ); //clear the interrupt
-                                rcode = 0x00;
-                                break;
-                        }//if( tmpdata & bmHXFRDNIRQ
-
-                }//while ( millis() < timeout
 
-                //if (rcode != 0x00) //exit if timeout
-                //        return ( rcode);
+                rcode = waitXferDone(); //wait for transfer completion
+                if(rcode)
+                        return (rcode);
 
                 rcode = (regRd(rHRSL) & 0x0f); //analyze transfer result
 
@@ -423,10 +441,45 @@ uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
                                 return (rcode);
                 }//switch( rcode
 
-        }//while( timeout > millis()
+        } while(!xferExpired());
+
+        xferOverruns++; // Still NAKing or timing out when the budget ran out
         return ( rcode);
 }
 
+/* Start the budget of a new transfer, 'budget' is in microseconds */
+void USB::startXfer(uint32_t budget) {
+        xferStart = (uint32_t)micros();
+        xferBudget = budget;
+}
+
+bool USB::xferExpired() {
+        return ((uint32_t)micros() - xferStart) >= xferBudget;
+}
+
+/* Wait for the HXFRDN interrupt of the packet that was just launched and clear it. */
+/* Returns USB_ERROR_TRANSFER_TIMEOUT if the MAX3421E never finishes the packet.    */
+/* One timeout only fails the transfer, the chip is reset after several in a row.   */
+uint8_t USB::waitXferDone() {
+        uint32_t start = (uint32_t)micros();
+
+        while(!(regRd(rHIRQ) & bmHXFRDNIRQ)) {
+#if defined(ESP8266) || defined(ESP32)
+                yield(); // needed in order to reset the watchdog timer on the ESP8266
+#endif
+                if(((uint32_t)micros() - start) >= USB_HXFRDN_TIMEOUT) {
+                        if(++bHostTimeouts >= USB_HOST_FAULT_TIMEOUTS) {
+                                bHostTimeouts = USB_HOST_FAULT_TIMEOUTS;
+                                bHostFault = true; // Recover() resets the chip
+                        }
+                        return USB_ERROR_TRANSFER_TIMEOUT;
+                }
+        }
+        regWr(rHIRQ, bmHXFRDNIRQ); //clear the interrupt
+        bHostTimeouts = 0;
+        return 0;
+}
+
 /* USB main task. Performs enumeration/cleanup */
 void USB::Task(void) //USB state machine
 {
@@ -449,6 +502,8 @@ void USB::Task(void) //USB state machine
                 case SE0: //disconnected
                         if((usb_task_state & USB_STATE_MASK) != USB_STATE_DETACHED)
                                 usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE;
+                        if(isRecovering())
+                                bRecoverLevel = USB_RECOVER_IDLE; // Nothing left to recover
                         lowspeed = false;
                         break;
                 case LSHOST:
@@ -459,19 +514,20 @@ void USB::Task(void) //USB state machine
                         if((usb_task_state & USB_STATE_MASK) == USB_STATE_DETACHED) {
                                 delay = (uint32_t)millis() + USB_SETTLE_DELAY;
                                 usb_task_state = USB_ATTACHED_SUBSTATE_SETTLE;
+                                markAttach();
                         }
                         break;
         }// switch( tmpdata
 
-        for(uint8_t i = 0; i < USB_NUMDEVICES; i++)
-                if(devConfig[i])
-                        rcode = devConfig[i]->Poll();
+        rcode = PollDrivers();
+
+        Recover();
 
         switch(usb_task_state) {
                 case USB_DETACHED_SUBSTATE_INITIALIZE:
                         init();
 
-                        for(uint8_t i = 0; i < USB_NUMDEVICES; i++)
+                        for(uint8_t i = 0; i < USB_NUMDRIVERS; i++)
                                 if(devConfig[i])
                                         rcode = devConfig[i]->Release();
 
@@ -522,18 +578,53 @@ void USB::Task(void) //USB state machine
                                 if(rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE) {
                                         usb_error = rcode;
                                         usb_task_state = USB_STATE_ERROR;
+                                        ReportFault(0, 0, lowspeed);
                                 }
                         } else
                                 usb_task_state = USB_STATE_RUNNING;
                         break;
                 case USB_STATE_RUNNING:
                         break;
-                case USB_STATE_ERROR:
-                        //MAX3421E::Init();
+                case USB_STATE_ERROR: // Recover() brings the device back
                         break;
         } // switch( usb_task_state )
 }
 
+/* Polls every running driver, through the sketch's own list if it attached one. */
+uint8_t USB::PollDrivers() {
+        if(pFuncPollDrivers)
+                return pFuncPollDrivers(); // The sketch polls its own driver list
+
+        uint8_t rcode = 0;
+        for(uint8_t i = 0; i < USB_NUMDRIVERS; i++)
+                if(devConfig[i])
+                        rcode = devConfig[i]->Poll();
+        return rcode;
+}
+
+/* Wait used while a device is being enumerated. Instead of spinning, the devices that are already */
+/* running are polled and the user function is called, so they keep working during the wait.       */
+/* Devices that are still being configured have polling disabled, and hubs will not start another  */
+/* enumeration while one is in progress, so this can not recurse into Configuring().               */
+/* If a driver polled from here, or the user function, calls enumDelay() again, that inner         */
+/* wait busy-spins until its time is up. Polling from it would re-enter the drivers and the user   */
+/* function that are already running further up the stack.                                         */
+void USB::enumDelay(uint16_t ms) {
+        uint32_t timeout = (uint32_t)millis() + ms;
+
+        while((int32_t)((uint32_t)millis() - timeout) < 0L) {
+                if(bInEnumDelay)
+                        continue; // Called from within a poll, spin until the time is up
+
+                bInEnumDelay = true;
+                PollDrivers();
+
+                if(pFuncOnEnumDelay)
+                        pFuncOnEnumDelay(); // Call the user function
+                bInEnumDelay = false;
+        }
+}
+
 uint8_t USB::DefaultAddressing(uint8_t parent, uint8_t port, bool lowspeed) {
         //uint8_t                buf[12];
         uint8_t rcode;
@@ -581,16 +672,9 @@ uint8_t USB::AttemptConfig(uint8_t driver, uint8_t parent, uint8_t port, bool lo
 again:
         uint8_t rcode = devConfig[driver]->ConfigureDevice(parent, port, lowspeed);
         if(rcode == USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET) {
-                if(parent == 0) {
-                        // Send a bus reset on the root interface.
-                        regWr(rHCTL, bmBUSRST); //issue bus reset
-                        delay(102); // delay 102ms, compensate for clock inaccuracy.
-                } else {
-                        // reset parent port
-                        devConfig[parent]->ResetHubPort(port);
-                }
+                ResetParentPort(parent, port);
         } else if(rcode == hrJERR && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
-                delay(100);
+                enumDelay(100);
                 retries++;
                 goto again;
         } else if(rcode)
@@ -598,20 +682,13 @@ again:
 
         rcode = devConfig[driver]->Init(parent, port, lowspeed);
         if(rcode == hrJERR && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
-                delay(100);
+                enumDelay(100);
                 retries++;
                 goto again;
         }
         if(rcode) {
                 // Issue a bus reset, because the device may be in a limbo state
-                if(parent == 0) {
-                        // Send a bus reset on the root interface.
-                        regWr(rHCTL, bmBUSRST); //issue bus reset
-                        delay(102); // delay 102ms, compensate for clock inaccuracy.
-                } else {
-                        // reset parent port
-                        devConfig[parent]->ResetHubPort(port);
-                }
+                ResetParentPort(parent, port);
         }
         return rcode;
 }
@@ -657,6 +734,168 @@ again:
  *
  */
 uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
+        bEnumerating++;
+        uint8_t rcode = ConfigureNewDevice(parent, port, lowspeed);
+        bEnumerating--;
+
+        if(!rcode) {
+                lastEnumTime = (uint16_t)((uint32_t)millis() - qAttachTime);
+                bLastEnumCached = (pCachedDevice != NULL);
+#ifdef DEBUG_USB_HOST
+                Notify(PSTR("\r\nEnumeration time: "), 0x80);
+                D_PrintHex<uint16_t > (lastEnumTime, 0x80);
+                if(bLastEnumCached)
+                        Notify(PSTR(" (cached)"), 0x80);
+#endif
+                // The hub index of a device can change when the root port was reset, so only the port is compared
+                if(isRecovering() && port == bRecoverPort && (parent == 0) == (bRecoverParent == 0))
+                        RecoverDone();
+        }
+        pCachedDevice = NULL;
+        return rcode;
+}
+
+/* Reset the port a device is connected to, either the root port or a port of the hub whose address field is 'parent' */
+void USB::ResetParentPort(uint8_t parent, uint8_t port) {
+        if(parent == 0) {
+                // Send a bus reset on the root interface.
+                regWr(rHCTL, bmBUSRST); //issue bus reset
+                enumDelay(102); // delay 102ms, compensate for clock inaccuracy.
+                return;
+        }
+
+        // reset parent port
+        for(uint8_t i = 0; i < USB_NUMDRIVERS; i++) {
+                if(!devConfig[i])
+                        continue;
+
+                UsbDeviceAddress a;
+                a.devAddress = devConfig[i]->GetAddress();
+                if(a.bmHub && a.bmAddress == parent) {
+                        devConfig[i]->ResetHubPort(port);
+                        return;
+                }
+        }
+}
+
+/* Called when a device failed to configure. Starts the recovery of it unless another device is being recovered already. */
+/* A device on a hub port that is missed here is found again by the disabled port sweep of the hub.                      */
+void USB::ReportFault(uint8_t parent, uint8_t port, bool lowspeed) {
+        if(bRecoverLevel != USB_RECOVER_IDLE)
+                return;
+
+        bRecoverLevel = USB_RECOVER_RETRY;
+        bRecoverWaiting = false;
+        bRecoverParent = parent;
+        bRecoverPort = port;
+        bRecoverLowSpeed = lowspeed;
+        qFaultTime = (uint32_t)millis();
+        qRecoverTime = qFaultTime + USB_RECOVER_DELAY;
+}
+
+/* Called when a device was unplugged, so it is not recovered anymore */
+void USB::ClearFault(uint8_t parent, uint8_t port) {
+        if(isRecovering() && port == bRecoverPort && parent == bRecoverParent)
+                bRecoverLevel = USB_RECOVER_IDLE;
+}
+
+/* Fault recovery engine, run from Task() after the running devices were polled, so they keep working meanwhile. */
+/* Every level is tried once, each one more disruptive than the one before, until the device configures again.   */
+void USB::Recover() {
+        uint8_t rcode = 0;
+
+        // A hung host controller can only be fixed by resetting it
+        if(bHostFault && bRecoverLevel < USB_RECOVER_HOST_RESET) {
+                if(bRecoverLevel == USB_RECOVER_IDLE) {
+                        qFaultTime = (uint32_t)millis();
+                        bRecoverParent = 0;
+                        bRecoverPort = 0;
+                }
+                bRecoverLevel = USB_RECOVER_HOST_RESET;
+                bRecoverWaiting = false;
+                qRecoverTime = (uint32_t)millis();
+        }
+
+        if(bRecoverLevel == USB_RECOVER_IDLE || (int32_t)((uint32_t)millis() - qRecoverTime) < 0L)
+                return;
+
+        switch(bRecoverLevel) {
+                case USB_RECOVER_RETRY:
+                        rcode = Configuring(bRecoverParent, bRecoverPort, bRecoverLowSpeed);
+                        break;
+                case USB_RECOVER_PORT_RESET:
+                        bEnumerating++; // Keeps the hub from handling the port change
+                        ResetParentPort(bRecoverParent, bRecoverPort);
+                        bEnumerating--;
+                        rcode = Configuring(bRecoverParent, bRecoverPort, bRecoverLowSpeed);
+                        break;
+                case USB_RECOVER_BUS_RESET:
+                case USB_RECOVER_HOST_RESET:
+                        if(bRecoverWaiting) {
+                                rcode = USB_ERROR_TRANSFER_TIMEOUT; // The device did not come back in time
+                                break;
+                        }
+                        if(bRecoverLevel == USB_RECOVER_HOST_RESET) {
+                                if(pFuncOnHostReset)
+                                        pFuncOnHostReset(); // Call the user function
+                                if(Init() == -1) {
+                                        // The oscillator didn't start. bHostFault stays set, so the reset is tried again after the holdoff
+                                        rcode = USB_ERROR_TRANSFER_TIMEOUT;
+                                        break;
+                                }
+                                bHostFault = false;
+                                bHostTimeouts = 0;
+                        }
+                        // Everything on the root port is released and enumerated again by Task()
+                        usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE;
+                        bRecoverWaiting = true;
+                        qRecoverTime = (uint32_t)millis() + USB_RECOVER_WINDOW;
+                        return;
+                case USB_RECOVER_GAVE_UP:
+                        bRecoverLevel = USB_RECOVER_IDLE;
+                        // Enumerate a root device that is still plugged in from scratch, if it fails again the levels start over.
+                        // A device on a hub port is found again by the disabled port sweep of the hub.
+                        if(bRecoverParent == 0 && usb_task_state == USB_STATE_ERROR)
+                                usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE;
+                        return;
+        }
+
+        if(!rcode) {
+                if(bRecoverParent == 0 && usb_task_state == USB_STATE_ERROR)
+                        usb_task_state = USB_STATE_RUNNING;
+                return; // RecoverDone() was called by Configuring()
+        }
+
+        if(rcode == USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE) {
+                qRecoverTime = (uint32_t)millis() + USB_RECOVER_DELAY; // Not done yet, try the same level again
+                return;
+        }
+
+        bRecoverLevel++;
+        // Resetting the root port is what the bus reset level does for a device on the root port
+        if(bRecoverParent == 0 && bRecoverLevel == USB_RECOVER_BUS_RESET)
+                bRecoverLevel++;
+        bRecoverWaiting = false;
+        qRecoverTime = (uint32_t)millis() + ((bRecoverLevel == USB_RECOVER_GAVE_UP) ? USB_RECOVER_HOLDOFF : USB_RECOVER_DELAY);
+#ifdef DEBUG_USB_HOST
+        Notify(PSTR("\r\nRecovery level: "), 0x80);
+        D_PrintHex<uint8_t > (bRecoverLevel, 0x80);
+#endif
+}
+
+void USB::RecoverDone() {
+        lastRecoverTime = (uint16_t)((uint32_t)millis() - qFaultTime);
+        bLastRecoverLevel = bRecoverLevel;
+        recoverCount++;
+        bRecoverLevel = USB_RECOVER_IDLE;
+        bRecoverWaiting = false;
+#ifdef DEBUG_USB_HOST
+        Notify(PSTR("\r\nRecovered in: "), 0x80);
+        D_PrintHex<uint16_t > (lastRecoverTime, 0x80);
+#endif
+}
+
+uint8_t USB::ConfigureNewDevice(uint8_t parent, uint8_t port, bool lowspeed) {
         //uint8_t bAddress = 0;
         //printf("Configuring: parent = %i, port = %i\r\n", parent, port);
         uint8_t devConfigIndex;
@@ -710,13 +949,22 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
         uint16_t pid = udd->idProduct;
         uint8_t klass = udd->bDeviceClass;
         uint8_t subklass = udd->bDeviceSubClass;
+        wConfiguringVID = vid;
+        wConfiguringPID = pid;
+
+        // Known device. It is probed like any other, so it goes to the first free driver that takes it,
+        // and that driver can use the cache entry to skip reading the rest of the descriptors.
+        pCachedDevice = descCache.Lookup(vid, pid);
+        if(pCachedDevice && (pCachedDevice->bcdDevice != udd->bcdDevice || pCachedDevice->bMaxPacketSize0 != udd->bMaxPacketSize0))
+                pCachedDevice = NULL; // Different revision of the device, do the full walk
+
         // Attempt to configure if VID/PID or device class matches with a driver
         // Qualify with subclass too.
         //
         // VID/PID & class tests default to false for drivers not yet ported
         // subclass defaults to true, so you don't have to define it if you don't have to.
         //
-        for(devConfigIndex = 0; devConfigIndex < USB_NUMDEVICES; devConfigIndex++) {
+        for(devConfigIndex = 0; devConfigIndex < USB_NUMDRIVERS; devConfigIndex++) {
                 if(!devConfig[devConfigIndex]) continue; // no driver
                 if(devConfig[devConfigIndex]->GetAddress()) continue; // consumed
                 if(devConfig[devConfigIndex]->DEVSUBCLASSOK(subklass) && (devConfig[devConfigIndex]->VIDPIDOK(vid, pid) || devConfig[devConfigIndex]->DEVCLASSOK(klass))) {
@@ -726,13 +974,14 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
                 }
         }
 
-        if(devConfigIndex < USB_NUMDEVICES) {
-                return rcode;
+        if(devConfigIndex < USB_NUMDRIVERS) {
+                goto Done;
         }
+        pCachedDevice = NULL; // No driver took it by VID/PID, the blind attempts below don't get the cache entry
 
 
         // blindly attempt to configure
-        for(devConfigIndex = 0; devConfigIndex < USB_NUMDEVICES; devConfigIndex++) {
+        for(devConfigIndex = 0; devConfigIndex < USB_NUMDRIVERS; devConfigIndex++) {
                 if(!devConfig[devConfigIndex]) continue;
                 if(devConfig[devConfigIndex]->GetAddress()) continue; // consumed
                 if(devConfig[devConfigIndex]->DEVSUBCLASSOK(subklass) && (devConfig[devConfigIndex]->VIDPIDOK(vid, pid) || devConfig[devConfigIndex]->DEVCLASSOK(klass))) continue; // If this is true it means it must have returned USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED above
@@ -745,20 +994,34 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
                         //                next time the program gets here
                         //if (rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE)
                         //        devConfigIndex = 0;
-                        return rcode;
+                        goto Done;
                 }
         }
         // if we get here that means that the device class is not supported by any of registered classes
+        pCachedDevice = NULL;
         rcode = DefaultAddressing(parent, port, lowspeed);
 
         return rcode;
+
+Done:
+        if(!rcode) {
+                // Remember the device. The driver may have added its endpoint layout already.
+                UsbDescCacheEntry *e = descCache.Store(vid, pid);
+                e->bcdDevice = udd->bcdDevice;
+                e->bMaxPacketSize0 = udd->bMaxPacketSize0;
+        } else if(pCachedDevice && rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE) {
+                // The short path failed, so forget the device and do the full walk next time
+                descCache.Invalidate(vid, pid);
+                pCachedDevice = NULL;
+        }
+        return rcode;
 }
 
 uint8_t USB::ReleaseDevice(uint8_t addr) {
         if(!addr)
                 return 0;
 
-        for(uint8_t i = 0; i < USB_NUMDEVICES; i++) {
+        for(uint8_t i = 0; i < USB_NUMDRIVERS; i++) {
                 if(!devConfig[i]) continue;
                 if(devConfig[i]->GetAddress() == addr)
                         return devConfig[i]->Release();
@@ -804,10 +1067,10 @@ uint8_t USB::getStrDescr(uint8_t addr, uint8_t ep, uint16_t ns, uint8_t index, u
 }
 //set address
 
-uint8_t USB::setAddr(uint8_t oldaddr, uint8_t ep, uint8_t newaddr) {
+uint8_t USB::setAddr(uint8_t oldaddr, uint8_t ep, uint8_t newaddr, uint16_t settle) {
         uint8_t rcode = ctrlReq(oldaddr, ep, bmREQ_SET, USB_REQUEST_SET_ADDRESS, newaddr, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL);
         //delay(2); //per USB 2.0 sect.9.2.6.3
-        delay(300); // Older spec says you should wait at least 200ms
+        enumDelay(settle); // Older spec says you should wait at least 200ms
         return rcode;
         //return ( ctrlReq(oldaddr, ep, bmREQ_SET, USB_REQUEST_SET_ADDRESS, newaddr, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL));
 }
@@ -31,6 +31,7 @@ e-mail   :  support@circuitsathome.com
 #include "sink_parser.h"
 #include "max3421e.h"
 #include "address.h"
+#include "desccache.h"
 #include "avrpins.h"
 #include "usb_ch9.h"
 #include "usbhost.h"
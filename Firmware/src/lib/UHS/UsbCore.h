@@ -97,11 +97,32 @@ typedef MAX3421e<P10, P9> MAX3421E; // Official Arduinos (UNO, Duemilanove, Mega
 #define USB_ERROR_TRANSFER_TIMEOUT                      0xFF
 
 #define USB_XFER_TIMEOUT        5000    // (5000) USB transfer timeout in milliseconds, per section 9.2.6.1 of USB 2.0 spec
+// Transfer budgets in microseconds. The caller of a transfer picks how long it may take, including NAK and timeout retries.
+#define USB_CTRL_BUDGET         ((uint32_t)USB_XFER_TIMEOUT * 1000UL) // control transfers, used during enumeration
+#define USB_POLL_BUDGET         750     // interrupt IN polls, so a slow device can not hold up the other players
+#define USB_OUT_BUDGET          2000    // interrupt OUT transfers such as rumble and LED commands
+#define USB_HXFRDN_TIMEOUT      3000    // the MAX3421E finishes every packet within a frame, this only catches a hung chip
+#define USB_HOST_FAULT_TIMEOUTS 8       // HXFRDN timeouts in a row before the MAX3421E is taken to be hung and reset
+
+// Fault recovery levels, tried in this order until the failed device configures again. See USB::Recover()
+#define USB_RECOVER_IDLE        0       // nothing to recover
+#define USB_RECOVER_RETRY       1       // configure the failed device again
+#define USB_RECOVER_PORT_RESET  2       // reset the hub or root port of the device, then configure it again
+#define USB_RECOVER_BUS_RESET   3       // re-enumerate everything on the root port
+#define USB_RECOVER_HOST_RESET  4       // reset the MAX3421E
+#define USB_RECOVER_GAVE_UP     5       // all levels failed, wait USB_RECOVER_HOLDOFF, then enumerate a failed root device again
+#define USB_RECOVER_DELAY       100     // delay in milliseconds before the next recovery level is tried
+#define USB_RECOVER_WINDOW      3000    // time in milliseconds a bus or host reset has to bring the device back
+#define USB_RECOVER_HOLDOFF     10000   // time in milliseconds before a new fault is handled after giving up
 //#define USB_NAK_LIMIT         32000   // NAK limit for a transfer. 0 means NAKs are not counted
 #define USB_RETRY_LIMIT         3       // 3 retry limit for a transfer
 #define USB_SETTLE_DELAY        200     // settle delay in milliseconds
+#define USB_SETADDR_DELAY       300     // recovery time after SetAddress in milliseconds, older spec says at least 200ms
 
-#define USB_NUMDEVICES          16      //number of USB devices
+#ifndef USB_NUMDRIVERS
+#define USB_NUMDRIVERS          16      //number of device drivers that can be registered
+#endif
+#define USB_NUMDEVICES          (USB_NUMDRIVERS + 1) //number of USB addresses, entry 0 is the default address
 //#define HUB_MAX_HUBS          7       // maximum number of hubs that can be attached to the host controller
 #define HUB_PORT_RESET_DELAY    20      // hub port reset delay 10 ms recomended, can be up to 20 ms
 
@@ -201,8 +222,35 @@ public:
 
 class USB : public MAX3421E {
         AddressPoolImpl<USB_NUMDEVICES> addrPool;
-        USBDeviceConfig* devConfig[USB_NUMDEVICES];
+        USBDeviceConfig* devConfig[USB_NUMDRIVERS];
         uint8_t bmHubPre;
+        uint8_t bEnumerating; // Nesting depth of Configuring()
+        bool bInEnumDelay; // Set while enumDelay() is servicing the running devices
+        void (*pFuncOnEnumDelay)(void); // Pointer to function called while enumeration is waiting
+        uint8_t (*pFuncPollDrivers)(void); // Pointer to function that polls the drivers instead of devConfig[]
+        UsbDescCache descCache;
+        UsbDescCacheEntry *pCachedDevice; // Cache entry of the device being configured, NULL if unknown
+        uint16_t wConfiguringVID; // VID and PID of the device being configured
+        uint16_t wConfiguringPID;
+        uint32_t qAttachTime; // When the last device was attached
+        uint16_t lastEnumTime; // Attach to configured time of the last device in milliseconds
+        bool bLastEnumCached; // True if the last device was configured from the descriptor cache
+        uint32_t xferStart; // micros() when the current transfer started
+        uint32_t xferBudget; // Time the current transfer may take in microseconds
+        uint16_t xferOverruns; // Number of transfers that were given up because they ran out of time
+        uint8_t bRecoverLevel; // Current USB_RECOVER_ level
+        bool bRecoverWaiting; // The action of the current level was done, waiting for the device to come back
+        uint8_t bRecoverParent; // Parent and port of the device being recovered
+        uint8_t bRecoverPort;
+        bool bRecoverLowSpeed;
+        bool bHostFault; // Set when the MAX3421E stopped responding
+        uint8_t bHostTimeouts; // HXFRDN timeouts in a row, see USB_HOST_FAULT_TIMEOUTS
+        uint32_t qRecoverTime; // When the next recovery step is due
+        uint32_t qFaultTime; // When the fault being recovered happened
+        uint16_t recoverCount; // Number of successful recoveries
+        uint16_t lastRecoverTime; // Fault to recovered time of the last recovery in milliseconds
+        uint8_t bLastRecoverLevel; // Level that brought the device back the last time
+        void (*pFuncOnHostReset)(void); // Pointer to function that pulses the reset pin of the MAX3421E
 
 public:
         USB(void);
@@ -220,7 +268,7 @@ public:
         };
 
         uint8_t RegisterDeviceClass(USBDeviceConfig *pdev) {
-                for(uint8_t i = 0; i < USB_NUMDEVICES; i++) {
+                for(uint8_t i = 0; i < USB_NUMDRIVERS; i++) {
                         if(!devConfig[i]) {
                                 devConfig[i] = pdev;
                                 return 0;
@@ -229,6 +277,103 @@ public:
                 return USB_ERROR_UNABLE_TO_REGISTER_DEVICE_CLASS;
         };
 
+        /**
+         * Used to call your own function while a device is being enumerated and the stack is waiting on it,
+         * so already running devices can be serviced instead of being frozen for the length of the enumeration.
+         * @param funcOnEnumDelay Function to call.
+         */
+        void attachOnEnumDelay(void (*funcOnEnumDelay)(void)) {
+                pFuncOnEnumDelay = funcOnEnumDelay;
+        };
+
+        /**
+         * Used to poll the drivers from a compile time list, see usbdrivers.h, instead of through
+         * the virtual Poll() of every registered driver.
+         * @param funcPollDrivers Function that polls every driver and returns the first error.
+         */
+        void attachDriverPoll(uint8_t (*funcPollDrivers)(void)) {
+                pFuncPollDrivers = funcPollDrivers;
+        };
+
+        /**
+         * Used to reset the MAX3421E through its reset pin, which is the last recovery level.
+         * The stack reinitializes the chip after calling it.
+         * @param funcOnHostReset Function to call.
+         */
+        void attachOnHostReset(void (*funcOnHostReset)(void)) {
+                pFuncOnHostReset = funcOnHostReset;
+        };
+
+        /** @return True while a failed device is being recovered. */
+        bool isRecovering(void) {
+                return (bRecoverLevel != USB_RECOVER_IDLE && bRecoverLevel != USB_RECOVER_GAVE_UP);
+        };
+
+        /** @return Number of faults that were recovered since power on. */
+        uint16_t getRecoveries() {
+                return recoverCount;
+        };
+
+        /** @return Time from the fault until the device was configured again the last time, in milliseconds. */
+        uint16_t getLastRecoverTime() {
+                return lastRecoverTime;
+        };
+
+        /** @return The USB_RECOVER_ level that brought the device back the last time. */
+        uint8_t getLastRecoverLevel() {
+                return bLastRecoverLevel;
+        };
+
+        /** @return True while a new device is being configured. */
+        bool isEnumerating(void) {
+                return (bEnumerating > 0);
+        };
+
+        UsbDescCache& GetDescCache() {
+                return descCache;
+        };
+
+        /**
+         * Used by the drivers while they are being initialized.
+         * @return The cache entry of the device that is being configured, or NULL if it has not been seen before.
+         */
+        UsbDescCacheEntry* GetCachedDevice() {
+                return pCachedDevice;
+        };
+
+        /** @return VID of the device that is being configured, for drivers that are created on demand. */
+        uint16_t GetConfiguringVID() {
+                return wConfiguringVID;
+        };
+
+        /** @return PID of the device that is being configured. */
+        uint16_t GetConfiguringPID() {
+                return wConfiguringPID;
+        };
+
+        /** Called when a device is attached, so the time it takes to enumerate can be measured. */
+        void markAttach() {
+                qAttachTime = (uint32_t)millis();
+        };
+
+        uint32_t getAttachTime() {
+                return qAttachTime;
+        };
+
+        /** @return Time from attach until the last device was configured, in milliseconds. */
+        uint16_t getLastEnumTime() {
+                return lastEnumTime;
+        };
+
+        bool isLastEnumCached() {
+                return bLastEnumCached;
+        };
+
+        /** @return Number of transfers that ran out of their budget since power on. */
+        uint16_t getXferOverruns() {
+                return xferOverruns;
+        };
+
         void ForEachUsbDevice(UsbDeviceHandleFunc pfunc) {
                 addrPool.ForEachUsbDevice(pfunc);
         };
@@ -245,30 +390,41 @@ public:
         uint8_t getConfDescr(uint8_t addr, uint8_t ep, uint8_t conf, USBReadParser *p);
 
         uint8_t getStrDescr(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t index, uint16_t langid, uint8_t* dataptr);
-        uint8_t setAddr(uint8_t oldaddr, uint8_t ep, uint8_t newaddr);
+        uint8_t setAddr(uint8_t oldaddr, uint8_t ep, uint8_t newaddr, uint16_t settle = USB_SETADDR_DELAY);
         uint8_t setConf(uint8_t addr, uint8_t ep, uint8_t conf_value);
         /**/
         uint8_t ctrlData(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dataptr, bool direction);
         uint8_t ctrlStatus(uint8_t ep, bool direction, uint16_t nak_limit);
-        uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval = 0);
-        uint8_t outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data);
+        uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval = 0, uint32_t budget = USB_CTRL_BUDGET);
+        uint8_t outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, uint32_t budget = USB_CTRL_BUDGET);
         uint8_t dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit);
 
         void Task(void);
+        void enumDelay(uint16_t ms);
 
         uint8_t DefaultAddressing(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Configuring(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t ReleaseDevice(uint8_t addr);
+        void ReportFault(uint8_t parent, uint8_t port, bool lowspeed);
+        void ClearFault(uint8_t parent, uint8_t port);
 
         uint8_t ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bRequest, uint8_t wValLo, uint8_t wValHi,
-                uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p);
+                uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p, uint32_t budget = USB_CTRL_BUDGET);
 
 private:
         void init();
+        uint8_t PollDrivers();
+        void startXfer(uint32_t budget);
+        bool xferExpired();
+        uint8_t waitXferDone();
         uint8_t SetAddress(uint8_t addr, uint8_t ep, EpInfo **ppep, uint16_t *nak_limit);
         uint8_t OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data);
         uint8_t InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t *data, uint8_t bInterval = 0);
         uint8_t AttemptConfig(uint8_t driver, uint8_t parent, uint8_t port, bool lowspeed);
+        uint8_t ConfigureNewDevice(uint8_t parent, uint8_t port, bool lowspeed);
+        void ResetParentPort(uint8_t parent, uint8_t port);
+        void Recover();
+        void RecoverDone();
 };
 
 #if 0 //defined(USB_METHODS_INLINE)
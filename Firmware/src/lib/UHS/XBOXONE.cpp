@@ -24,13 +24,14 @@
 //#define EXTRADEBUG // Uncomment to get even more debugging data
 //#define PRINTREPORT // Uncomment to print the report send by the Xbox ONE Controller
 
-XBOXONE::XBOXONE(USB *p) :
+XBOXONE::XBOXONE(USB *p, bool bRegister) :
 pUsb(p), // pointer to USB class instance - mandatory
 bAddress(0), // device address - mandatory
 bNumEP(1), // If config descriptor needs to be parsed
 qNextPollTime(0), // Reset NextPollTime
 pollInterval(0),
 bPollEnable(false) { // don't start polling before dongle is connected
+        rumbleReset();
         for(uint8_t i = 0; i < XBOX_ONE_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
                 epInfo[i].maxPktSize = (i) ? 0 : 8;
@@ -39,7 +40,7 @@ bPollEnable(false) { // don't start polling before dongle is connected
                 epInfo[i].bmNakPower = (i) ? USB_NAK_NOWAIT : USB_NAK_MAX_POWER;
         }
 
-        if(pUsb) // register in USB subsystem
+        if(pUsb && bRegister) // register in USB subsystem
                 pUsb->RegisterDeviceClass(this); //set devConfig[] entry
 }
 
@@ -51,6 +52,7 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         EpInfo *oldep_ptr = NULL;
         uint16_t PID, VID;
         uint8_t num_of_conf; // Number of configurations
+        UsbDescCacheEntry *cached = pUsb->GetCachedDevice(); // Set if this controller has been connected before
 
         // get memory address of USB device address pool
         AddressPool &addrPool = pUsb->GetAddressPool();
@@ -82,21 +84,30 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                 return USB_ERROR_EPINFO_IS_NULL;
         }
 
-        // Save old pointer to EP_RECORD of address 0
-        oldep_ptr = p->epinfo;
+        if(cached && cached->bNumEP == XBOX_ONE_MAX_ENDPOINTS - 1) {
+                // Known controller, the host has just read the device descriptor so don't read it again
+                udd->idVendor = cached->idVendor;
+                udd->idProduct = cached->idProduct;
+                udd->bMaxPacketSize0 = cached->bMaxPacketSize0;
+        } else {
+                cached = NULL;
 
-        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
-        p->epinfo = epInfo;
+                // Save old pointer to EP_RECORD of address 0
+                oldep_ptr = p->epinfo;
 
-        p->lowspeed = lowspeed;
+                // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
+                p->epinfo = epInfo;
 
-        // Get device descriptor
-        rcode = pUsb->getDevDescr(0, 0, sizeof (USB_DEVICE_DESCRIPTOR), (uint8_t*)buf); // Get device descriptor - addr, ep, nbytes, data
-        // Restore p->epinfo
-        p->epinfo = oldep_ptr;
+                p->lowspeed = lowspeed;
 
-        if(rcode)
-                goto FailGetDevDescr;
+                // Get device descriptor
+                rcode = pUsb->getDevDescr(0, 0, sizeof (USB_DEVICE_DESCRIPTOR), (uint8_t*)buf); // Get device descriptor - addr, ep, nbytes, data
+                // Restore p->epinfo
+                p->epinfo = oldep_ptr;
+
+                if(rcode)
+                        goto FailGetDevDescr;
+        }
 
         VID = udd->idVendor;
         PID = udd->idProduct;
@@ -114,7 +125,7 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         epInfo[0].maxPktSize = udd->bMaxPacketSize0;
 
         // Assign new address to the device
-        rcode = pUsb->setAddr(0, 0, bAddress);
+        rcode = pUsb->setAddr(0, 0, bAddress, USB_SETADDR_DELAY);
         if(rcode) {
                 p->lowspeed = false;
                 addrPool.FreeAddress(bAddress);
@@ -145,10 +156,21 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         if(rcode)
                 goto FailSetDevTblEntry;
 
-        num_of_conf = udd->bNumConfigurations; // Number of configurations
+        num_of_conf = (cached) ? 0 : udd->bNumConfigurations; // Number of configurations, known controllers restore the endpoints from the cache instead
 
         USBTRACE2("NC:", num_of_conf);
 
+        if(cached) {
+                // Same layout as last time, no need to walk the configuration descriptor
+                bConfNum = cached->bConfNum;
+                pollInterval = cached->bInterval;
+                epInfo[ XBOX_ONE_OUTPUT_PIPE ].epAddr = cached->epAddr[0] & 0x0F;
+                epInfo[ XBOX_ONE_OUTPUT_PIPE ].maxPktSize = cached->epMaxPktSize[0];
+                epInfo[ XBOX_ONE_INPUT_PIPE ].epAddr = cached->epAddr[1] & 0x0F;
+                epInfo[ XBOX_ONE_INPUT_PIPE ].maxPktSize = cached->epMaxPktSize[1];
+                bNumEP = XBOX_ONE_MAX_ENDPOINTS;
+        }
+
         // Check if attached device is a Xbox One controller and fill endpoint data structure
         for(uint8_t i = 0; i < num_of_conf; i++) {
                 ConfigDescParser<0, 0, 0, 0> confDescrParser(this); // Allow all devices, as we have already verified that it is a Xbox One controller from the VID and PID
@@ -166,7 +188,7 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         if(rcode)
                 goto FailSetDevTblEntry;
 
-        delay(200); // Give time for address change
+        pUsb->enumDelay(200); // Give time for address change
 
         rcode = pUsb->setConf(bAddress, epInfo[ XBOX_ONE_CONTROL_PIPE ].epAddr, bConfNum);
         if(rcode)
@@ -176,7 +198,7 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         Notify(PSTR("\r\nXbox One Controller Connected\r\n"), 0x80);
 #endif
 
-        delay(200); // let things settle
+        pUsb->enumDelay(200); // let things settle
 
         // Initialize the controller for input
         cmdCounter = 0; // Reset the counter used when sending out the commands
@@ -190,6 +212,18 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         if (rcode)
                 goto Fail;
 
+        if(!cached) {
+                // Remember the endpoint layout for the next time this controller is plugged in
+                cached = pUsb->GetDescCache().Store(VID, PID);
+                cached->bConfNum = bConfNum;
+                cached->bInterval = pollInterval;
+                cached->epAddr[0] = epInfo[ XBOX_ONE_OUTPUT_PIPE ].epAddr;
+                cached->epMaxPktSize[0] = epInfo[ XBOX_ONE_OUTPUT_PIPE ].maxPktSize;
+                cached->epAddr[1] = epInfo[ XBOX_ONE_INPUT_PIPE ].epAddr | 0x80;
+                cached->epMaxPktSize[1] = epInfo[ XBOX_ONE_INPUT_PIPE ].maxPktSize;
+                cached->bNumEP = XBOX_ONE_MAX_ENDPOINTS - 1;
+        }
+
         onInit();
         XboxOneConnected = true;
         bPollEnable = true;
@@ -306,7 +340,7 @@ uint8_t XBOXONE::Poll() {
         if((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L) { // Do not poll if shorter than polling interval
                 qNextPollTime = (uint32_t)millis() + pollInterval; // Set new poll time
                 uint16_t length =  (uint16_t)epInfo[ XBOX_ONE_INPUT_PIPE ].maxPktSize; // Read the maximum packet size from the endpoint
-                uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[ XBOX_ONE_INPUT_PIPE ].epAddr, &length, readBuf, pollInterval);
+                uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[ XBOX_ONE_INPUT_PIPE ].epAddr, &length, readBuf, pollInterval, USB_POLL_BUDGET);
                 if(!rcode) {
                         readReport();
 #ifdef PRINTREPORT // Uncomment "#define PRINTREPORT" to print the report send by the Xbox ONE Controller
@@ -324,6 +358,8 @@ uint8_t XBOXONE::Poll() {
                 }
 #endif
     }
+        if(rumbleEffect)
+                rumbleCheck(); // Only the pattern running late needs a command
     return rcode;
 }
 
@@ -412,7 +448,7 @@ int16_t XBOXONE::getAnalogHat(AnalogHatEnum a) {
 /* Xbox Controller commands */
 uint8_t XBOXONE::XboxCommand(uint8_t* data, uint16_t nbytes) {
         data[2] = cmdCounter++; 
-        uint8_t rcode = pUsb->outTransfer(bAddress, epInfo[ XBOX_ONE_OUTPUT_PIPE ].epAddr, nbytes, data);
+        uint8_t rcode = pUsb->outTransfer(bAddress, epInfo[ XBOX_ONE_OUTPUT_PIPE ].epAddr, nbytes, data, USB_OUT_BUDGET);
 #ifdef DEBUG_USB_HOST
         Notify(PSTR("\r\nXboxCommand, Return: "), 0x80);
         D_PrintHex<uint8_t > (rcode, 0x80);
@@ -442,35 +478,110 @@ void XBOXONE::onInit() {
         writeBuf[11] = 0x00; // Off period
         writeBuf[12] = 0x00; // Repeat count
         XboxCommand(writeBuf, 13);*/
+        rumbleReset();
 		setRumbleOff();
 
         if(pFuncOnInit)
                 pFuncOnInit(); // Call the user function
 }
 
-void XBOXONE::setRumbleOff() {
-        uint8_t writeBuf[13];
+uint8_t XBOXONE::setRumbleOff() {
+        return rumbleCommand(0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+}
 
-        // Activate rumble
-        writeBuf[0] = 0x09;
-        writeBuf[1] = 0x00;
-        // Byte 2 is set in "XboxCommand"
+uint8_t XBOXONE::setRumbleOn(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor) {
+        return rumbleCommand(leftTrigger, rightTrigger, leftMotor, rightMotor, 0xFF, 0x00, 0xFF);
+}
 
-        // Continuous rumble effect
-        writeBuf[3] = 0x09; // Substructure (what substructure rest of this packet has)
-        writeBuf[4] = 0x00; // Mode
-        writeBuf[5] = 0x0F; // Rumble mask (what motors are activated) (0000 lT rT L R)
-        writeBuf[6] = 0x00; // lT force
-        writeBuf[7] = 0x00; // rT force
-        writeBuf[8] = 0x00; // L force
-        writeBuf[9] = 0x00; // R force
-        writeBuf[10] = 0x00; // On period
-        writeBuf[11] = 0x00; // Off period
-        writeBuf[12] = 0x00; // Repeat count
-        XboxCommand(writeBuf, 13);
+void XBOXONE::rumbleReset() {
+        memset(rumbleForce, 0, sizeof(rumbleForce));
+        rumbleOn = false;
+        rumbleChanged = (uint16_t)millis();
+        rumblePeriod[0] = rumblePeriod[1] = 0;
+        rumbleMatches = 0;
+        rumbleEffect = 0;
+}
+
+// Set the forces the game last asked for, ending the effect if one is running
+uint8_t XBOXONE::rumbleSteady() {
+        uint8_t rcode;
+        if(rumbleOn)
+                rcode = setRumbleOn(rumbleForce[0], rumbleForce[1], rumbleForce[2], rumbleForce[3]);
+        else
+                rcode = setRumbleOff();
+        if(!rcode)
+                rumbleEffect = 0; // Otherwise the next Poll() tries again
+        return rcode;
+}
+
+// The game has stopped the pattern if the phase it is in has gone on for too long
+void XBOXONE::rumbleCheck() {
+        uint16_t elapsed = (uint16_t)millis() - rumbleChanged;
+        if(elapsed > (rumblePeriod[rumbleOn ? 0 : 1] + XBOX_ONE_RUMBLE_TOLERANCE) * 10U) {
+                rumbleMatches = 0;
+                rumbleSteady();
+        }
+}
+
+uint8_t XBOXONE::setRumble(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor) {
+        uint8_t force[4] = {leftTrigger, rightTrigger, leftMotor, rightMotor};
+        bool on = leftTrigger || rightTrigger || leftMotor || rightMotor;
+        bool sameForce = !on || !memcmp(force, rumbleForce, sizeof(force));
+        if(on == rumbleOn && sameForce)
+                return 0; // Nothing changed
+
+        uint16_t now = (uint16_t)millis();
+        uint16_t elapsed = (uint16_t)(now - rumbleChanged + 5) / 10;
+        uint8_t phase = elapsed > 0xFF ? 0xFF : elapsed; // Length of the phase that just ended
+        uint8_t ended = rumbleOn ? 0 : 1;
+        bool turnedOnOff = on != rumbleOn;
+
+        // The new state is worked out in these and only kept once the controller has taken it
+        uint8_t period[2] = {rumblePeriod[0], rumblePeriod[1]};
+        uint8_t matches = rumbleMatches;
+        uint8_t effect = rumbleEffect;
+
+        // Does the phase that ended keep to the pattern? A new pattern starts from it if not.
+        if(turnedOnOff && sameForce && phase >= XBOX_ONE_RUMBLE_MIN_PHASE && phase < 0xFF &&
+                phase + XBOX_ONE_RUMBLE_TOLERANCE >= period[ended] &&
+                phase <= period[ended] + XBOX_ONE_RUMBLE_TOLERANCE) {
+                if(matches < 0xFF)
+                        matches++;
+        } else {
+                matches = 0;
+                period[ended] = phase;
+        }
+
+        uint8_t rcode = 0;
+        if(effect && matches) {
+                // The controller is already doing this, only send the effect again now and then
+                if(on && ++effect > XBOX_ONE_RUMBLE_RESYNC) {
+                        effect = 1;
+                        rcode = rumbleCommand(leftTrigger, rightTrigger, leftMotor, rightMotor, period[0], period[1], 0xFF);
+                }
+        } else if(!on || matches < 2) {
+                effect = 0;
+                rcode = on ? setRumbleOn(leftTrigger, rightTrigger, leftMotor, rightMotor) : setRumbleOff();
+        } else {
+                // The last on and off phase were both the same as the ones before, repeat them on the controller
+                effect = 1;
+                rcode = rumbleCommand(leftTrigger, rightTrigger, leftMotor, rightMotor, period[0], period[1], 0xFF);
+        }
+        if(rcode)
+                return rcode; // Nothing was kept, so the same call sends it again
+
+        rumbleChanged = now;
+        rumbleOn = on;
+        if(on)
+                memcpy(rumbleForce, force, sizeof(force));
+        rumblePeriod[0] = period[0];
+        rumblePeriod[1] = period[1];
+        rumbleMatches = matches;
+        rumbleEffect = effect;
+        return 0;
 }
 
-void XBOXONE::setRumbleOn(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor) {
+uint8_t XBOXONE::rumbleCommand(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor, uint8_t onPeriod, uint8_t offPeriod, uint8_t repeat) {
         uint8_t writeBuf[13];
 
         // Activate rumble
@@ -478,7 +589,7 @@ void XBOXONE::setRumbleOn(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t lef
         writeBuf[1] = 0x00;
         // Byte 2 is set in "XboxCommand"
 
-        // Continuous rumble effect
+        // Rumble effect, continuous with an on period of 0xFF and no off period
         writeBuf[3] = 0x09; // Substructure (what substructure rest of this packet has)
         writeBuf[4] = 0x00; // Mode
         writeBuf[5] = 0x0F; // Rumble mask (what motors are activated) (0000 lT rT L R)
@@ -486,8 +597,8 @@ void XBOXONE::setRumbleOn(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t lef
         writeBuf[7] = rightTrigger; // rT force
         writeBuf[8] = leftMotor; // L force
         writeBuf[9] = rightMotor; // R force
-        writeBuf[10] = 0xFF; // On period
-        writeBuf[11] = 0x00; // Off period
-        writeBuf[12] = 0xFF; // Repeat count
-        XboxCommand(writeBuf, 13);
+        writeBuf[10] = onPeriod; // On period
+        writeBuf[11] = offPeriod; // Off period
+        writeBuf[12] = repeat; // Repeat count
+        return XboxCommand(writeBuf, 13);
 }
@@ -36,6 +36,11 @@
 
 #define XBOX_ONE_MAX_ENDPOINTS                  3
 
+/* Rumble pattern detection, see setRumble(). Times are in the 10ms units of the rumble command. */
+#define XBOX_ONE_RUMBLE_TOLERANCE               2  // How far a phase can be off the pattern and still keep to it
+#define XBOX_ONE_RUMBLE_MIN_PHASE               3  // Shorter on or off phases are never made into an effect
+#define XBOX_ONE_RUMBLE_RESYNC                  16 // Cycles before the effect is sent again, so it stays in step with the game
+
 // PID and VID of the different versions of the controller - see: https://github.com/torvalds/linux/blob/master/drivers/input/joystick/xpad.c
 
 // Official controllers
@@ -71,9 +76,10 @@ class XBOXONE : public USBDeviceConfig, public UsbConfigXtracter {
 public:
         /**
          * Constructor for the XBOXONE class.
-         * @param  pUsb   Pointer to USB class instance.
+         * @param  pUsb      Pointer to USB class instance.
+         * @param  bRegister False if the instance is owned by a UsbDriverSlot, which registers itself instead.
          */
-        XBOXONE(USB *pUsb);
+        XBOXONE(USB *pUsb, bool bRegister = true);
 
         /** @name USBDeviceConfig implementation */
         /**
@@ -126,6 +132,11 @@ public:
          * @return     Returns true if the device's VID and PID matches this driver.
          */
         virtual bool VIDPIDOK(uint16_t vid, uint16_t pid) {
+                return VIDPIDMatch(vid, pid);
+        };
+
+        /** Same as VIDPIDOK(), usable before there is an instance. */
+        static bool VIDPIDMatch(uint16_t vid, uint16_t pid) {
                 return ((vid == XBOX_VID1 ||
 												 vid == XBOX_VID2 ||
 												 vid == XBOX_VID3 ||
@@ -182,8 +193,11 @@ public:
                 pFuncOnInit = funcOnInit;
         };
 
-        /** Used to set the rumble off. */
-        void setRumbleOff();
+        /**
+         * Used to set the rumble off.
+         * @return 0 if the controller took the command.
+         */
+        uint8_t setRumbleOff();
 
         /**
          * Used to turn on rumble continuously.
@@ -191,8 +205,24 @@ public:
          * @param rightTrigger Right trigger force.
          * @param leftMotor    Left motor force.
          * @param rightMotor   Right motor force.
+         * @return 0 if the controller took the command.
+         */
+        uint8_t setRumbleOn(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor);
+
+        /**
+         * Used to follow rumble that is set by something else, e.g. a game, whenever it changes.
+         * Setting the same forces again sends nothing. When the motors are turned on and off with the
+         * same forces and timing twice in a row, the pattern is sent to the controller as one effect with
+         * an on and off period, and the calls that keep to it send nothing either. A call that breaks the
+         * pattern, or the pattern not carrying on in time (checked by Poll()), ends the effect.
+         * @param leftTrigger  Left trigger force.
+         * @param rightTrigger Right trigger force.
+         * @param leftMotor    Left motor force.
+         * @param rightMotor   Right motor force.
+         * @return 0 if the controller took the command, or nothing needed sending. Otherwise nothing
+         * is remembered, so calling again with the same forces sends the command again.
          */
-        void setRumbleOn(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor);
+        uint8_t setRumble(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor);
         /**@}*/
 
         /** True if a Xbox ONE controller is connected. */
@@ -256,9 +286,22 @@ private:
         uint8_t readBuf[XBOX_ONE_EP_MAXPKTSIZE]; // General purpose buffer for input data
         uint8_t cmdCounter;
 
+        /* Rumble pattern detection, see setRumble() */
+        uint8_t rumbleForce[4]; // Forces of the last on phase
+        bool rumbleOn; // The motors are on
+        uint16_t rumbleChanged; // millis() the motors last turned on or off
+        uint8_t rumblePeriod[2]; // Length of the on and off phase of the pattern
+        uint8_t rumbleMatches; // Phases in a row that kept to the pattern
+        uint8_t rumbleEffect; // Cycles since the effect was sent, 0 when there is no effect running
+
+        void rumbleReset();
+        uint8_t rumbleSteady();
+        void rumbleCheck();
+
         void readReport(); // Used to read the incoming data
 
         /* Private commands */
         uint8_t XboxCommand(uint8_t* data, uint16_t nbytes);
+        uint8_t rumbleCommand(uint8_t leftTrigger, uint8_t rightTrigger, uint8_t leftMotor, uint8_t rightMotor, uint8_t onPeriod, uint8_t offPeriod, uint8_t repeat);
 };
 #endif
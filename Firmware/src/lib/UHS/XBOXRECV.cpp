@@ -35,6 +35,15 @@ XBOXRECV::XBOXRECV(USB *p) : pUsb(p),
         epInfo[i].bmNakPower = (i) ? USB_NAK_NOWAIT : USB_NAK_MAX_POWER;
     }
 
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        lastSeen[i] = 0;
+        lastProbe[i] = 0;
+        nakStreak[i] = 0;
+        probesUnanswered[i] = 0;
+        outputTimer[i] = 0;
+    }
+
     if (pUsb)
         pUsb->RegisterDeviceClass(this);
 }
@@ -96,7 +105,7 @@ uint8_t XBOXRECV::ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed)
 
     epInfo[0].maxPktSize = udd->bMaxPacketSize0;
 
-    delay(20);
+    pUsb->enumDelay(20);
 
     return USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET;
 
@@ -138,7 +147,7 @@ uint8_t XBOXRECV::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
         return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
     }
 
-    delay(300);
+    pUsb->enumDelay(300);
 
     rcode = pUsb->setAddr(0, 0, bAddress);
     if (rcode)
@@ -233,7 +242,7 @@ uint8_t XBOXRECV::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
     if (rcode)
         goto FailSetDevTblEntry;
 
-    delay(200); //Give time for address change
+    pUsb->enumDelay(200); //Give time for address change
 
     rcode = pUsb->setConf(bAddress, epInfo[XBOX_CONTROL_PIPE].epAddr, 1);
     if (rcode)
@@ -275,8 +284,6 @@ uint8_t XBOXRECV::Poll()
 
     static uint32_t checkStatusTimer[4] = {0};
     static uint32_t chatPadLedTimer[4] = {0};
-    uint32_t timeout;
-    volatile static uint32_t idleTimer[4] = {0};
 
     for (uint8_t i = 0; i < 4; i++)
     {
@@ -289,58 +296,97 @@ uint8_t XBOXRECV::Poll()
             case 2: inputPipe = XBOX_INPUT_PIPE_3; break;
             case 3: inputPipe = XBOX_INPUT_PIPE_4; break;
         }
-        rcode = hrSUCCESS;
-        timeout = millis();
-        while (rcode != hrNAK && (millis() - timeout) < 50)
+        //One report per pass. A receiver with more queued hands over the next one on the next pass,
+        //so a controller that keeps answering can't hold up the others.
+        bool gotData = false;
+        uint16_t bufferSize = EP_MAXPKTSIZE;
+        rcode = pUsb->inTransfer(bAddress, epInfo[inputPipe].epAddr, &bufferSize, readBuf, 0, USB_POLL_BUDGET);
+        if (rcode == hrSUCCESS && bufferSize > 0)
         {
-            uint16_t bufferSize = EP_MAXPKTSIZE;
-            rcode = pUsb->inTransfer(bAddress, epInfo[inputPipe].epAddr, &bufferSize, readBuf);
-            if (bufferSize > 0)
-            {
-                //Reset idle timer on user input
-                if (readBuf[1] & 0x01)
-                    idleTimer[i] = millis();
-                readReport(i);
-            }
+            gotData = true;
+            readReport(i);
         }
+        trackPresence(i, gotData);
 
+        //One clock read for both housekeeping timers of this controller
+        uint32_t now = millis();
         if (chatPadInitNeeded[i])
         {
             enableChatPad(i);
             chatPadInitNeeded[i] = 0;
         }
-        else if (millis() - chatPadLedTimer[i] > 250)
+        else if (now - chatPadLedTimer[i] > 250)
         {
             chatPadProcessLed(i);
-            chatPadLedTimer[i] = millis();
+            chatPadLedTimer[i] = now;
         }
-        else if (millis() - checkStatusTimer[i] > 1000)
+        else if (now - checkStatusTimer[i] > 1000)
         {
             static uint8_t state[4] = {0};
             switch (state[i])
             {
                 case 0:
-                    if (!Xbox360Connected[i] || (millis() - idleTimer[i]) > 2500)
-                    {
+                    //Connected controllers are watched by trackPresence()
+                    if (!Xbox360Connected[i])
                         checkControllerPresence(i);
-                        idleTimer[i] = millis();
-                    }
                     break;
                 case 1: setLedRaw(0x06 + i, i); break;
                 case 2: chatPadKeepAlive1(i);   break;
                 case 3: chatPadKeepAlive2(i);   break;
             }
             state[i] = ((state[i] + 1) % 4);
-            checkStatusTimer[i] = millis();
+            checkStatusTimer[i] = now;
         }
     }
     return 0;
 }
 
+/*
+ * A controller that is switched off or re-syncs normally makes the receiver send a disconnect status
+ * packet, which readReport() handles. A controller that loses power or goes out of range can just go
+ * quiet though. Once its input pipe has been NAKed for a while, the receiver is asked if the controller
+ * is still there. The receiver always answers this, so a controller it does not answer for is lost too.
+ */
+void XBOXRECV::trackPresence(uint8_t controller, bool gotData)
+{
+    if (gotData || !Xbox360Connected[controller])
+    {
+        nakStreak[controller] = 0;
+        return;
+    }
+
+    if (nakStreak[controller] < 0xFF)
+        nakStreak[controller]++;
+
+    if (nakStreak[controller] < XBOX_PRESENCE_NAK_STREAK ||
+        millis() - lastSeen[controller] < XBOX_PRESENCE_IDLE ||
+        millis() - lastProbe[controller] < XBOX_PRESENCE_IDLE)
+        return;
+
+    //Don't hold up the loop for the spacing XboxCommand() keeps between commands, try again next poll
+    if (millis() - outputTimer[controller] < 8)
+        return;
+
+    if (probesUnanswered[controller] >= XBOX_PRESENCE_MAX_PROBES)
+    {
+        Xbox360Connected[controller] = 0x00;
+        probesUnanswered[controller] = 0;
+        return;
+    }
+
+    lastProbe[controller] = millis();
+    probesUnanswered[controller]++;
+    checkControllerPresence(controller);
+}
+
 void XBOXRECV::readReport(uint8_t controller)
 {
     if (readBuf == NULL)
         return;
+
+    //Anything from the receiver for this controller is an answer to a presence probe
+    lastSeen[controller] = millis();
+    probesUnanswered[controller] = 0;
     // This report is sent when a controller is connected and disconnected
     if (readBuf[0] & 0x08 && readBuf[1] != Xbox360Connected[controller])
     {
@@ -562,47 +608,48 @@ uint8_t XBOXRECV::getBatteryLevel(uint8_t controller)
     return ((controllerStatus[controller] & 0x00C0) >> 6);
 }
 
-void XBOXRECV::XboxCommand(uint8_t controller, uint8_t* data, uint16_t nbytes) {
+//Sends one command. The OUT transfer and the read back of the answer are each limited by their
+//budget, a command that doesn't go through returns the USB error code for the caller to retry.
+uint8_t XBOXRECV::XboxCommand(uint8_t controller, uint8_t* data, uint16_t nbytes) {
     uint8_t outputPipe;
-    static uint32_t outputTimer[4] = {0};
-    uint32_t timeout;
     switch(controller) {
         case 0: outputPipe = XBOX_OUTPUT_PIPE_1; break;
         case 1: outputPipe = XBOX_OUTPUT_PIPE_2; break;
         case 2: outputPipe = XBOX_OUTPUT_PIPE_3; break;
         case 3: outputPipe = XBOX_OUTPUT_PIPE_4; break;
-        default: return;
+        default: return USB_ERROR_INVALID_ARGUMENT;
     }
 
     //Send report (limit to 8ms between pipe transmissions)
     while (millis() - outputTimer[controller] < 8);
 
-    uint8_t rcode = hrNAK;
-    timeout= millis();
-    while (rcode != hrSUCCESS && (millis() - timeout) < 50)
-        rcode = pUsb->outTransfer(bAddress, epInfo[outputPipe].epAddr, nbytes, data);
-
-    //Readback any response
-    rcode = hrSUCCESS;
-    timeout= millis();
-    while (rcode != hrNAK && (millis() - timeout) < 50)
-    {
-        uint16_t bufferSize = EP_MAXPKTSIZE;
-        rcode = pUsb->inTransfer(bAddress, epInfo[outputPipe - 1].epAddr, &bufferSize, readBuf);
-        if (bufferSize > 0)
-            readReport(controller);
-    }
+    uint8_t rcode = pUsb->outTransfer(bAddress, epInfo[outputPipe].epAddr, nbytes, data, USB_OUT_BUDGET);
     outputTimer[controller] = millis();
+    if (rcode)
+        return rcode;
+
+    //Readback any response, anything more comes with the next Poll()
+    uint16_t bufferSize = EP_MAXPKTSIZE;
+    if (pUsb->inTransfer(bAddress, epInfo[outputPipe - 1].epAddr, &bufferSize, readBuf, 0, USB_POLL_BUDGET) == hrSUCCESS && bufferSize > 0)
+        readReport(controller);
+    return 0;
 }
 
-void XBOXRECV::disconnect(uint8_t controller)
+//Most commands are four bytes followed by zeros. One function to build them is smaller than
+//building each one inline.
+uint8_t XBOXRECV::XboxCommand(uint8_t controller, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
 {
     memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x08;
-    writeBuf[3] = 0xC0;
-    XboxCommand(controller, writeBuf, 12);
+    writeBuf[0] = b0;
+    writeBuf[1] = b1;
+    writeBuf[2] = b2;
+    writeBuf[3] = b3;
+    return XboxCommand(controller, writeBuf, 12);
+}
+
+void XBOXRECV::disconnect(uint8_t controller)
+{
+    XboxCommand(controller, 0x00, 0x00, 0x08, 0xC0);
 }
 
 /*
@@ -625,67 +672,37 @@ void XBOXRECV::disconnect(uint8_t controller)
 */
 void XBOXRECV::setLedRaw(uint8_t value, uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x08;
-    writeBuf[3] = value | 0x40;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x00, 0x00, 0x08, value | 0x40);
 }
 
 void XBOXRECV::checkControllerPresence(uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x08;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x0F;
-    writeBuf[3] = 0xc0;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x08, 0x00, 0x0F, 0xc0);
 }
 
 void XBOXRECV::checkControllerBattery(uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x00;
-    writeBuf[3] = 0x40;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x00, 0x00, 0x00, 0x40);
 }
 
 void XBOXRECV::enableChatPad(uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x0C;
-    writeBuf[3] = 0x1B;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x00, 0x00, 0x0C, 0x1B);
     chatpadEnabled = 1;
 }
 
 void XBOXRECV::chatPadKeepAlive1(uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x0C;
-    writeBuf[3] = 0x1F;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x00, 0x00, 0x0C, 0x1F);
     chatpadEnabled = 1;
 }
 
 void XBOXRECV::chatPadKeepAlive2(uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x0C;
-    writeBuf[3] = 0x1E;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x00, 0x00, 0x0C, 0x1E);
 }
 
-void XBOXRECV::setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller)
+uint8_t XBOXRECV::setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller)
 {
     memset(writeBuf, 0x00, 12);
     writeBuf[0] = 0x00;
@@ -695,21 +712,16 @@ void XBOXRECV::setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller)
     writeBuf[4] = 0x00;
     writeBuf[5] = lValue; // big weight
     writeBuf[6] = rValue; // small weight
-    XboxCommand(controller, writeBuf, 12);
+    return XboxCommand(controller, writeBuf, 12);
 }
 
 void XBOXRECV::onInit(uint8_t controller)
 {
-    memset(writeBuf, 0x00, 12);
     setLedRaw(0x00, controller);              //Set LED OFF
     setLedRaw(0x02 + controller, controller); //Set LED quadrant blinking
 
     //Not sure what this is, but windows driver does it
-    writeBuf[0] = 0x00;
-    writeBuf[1] = 0x00;
-    writeBuf[2] = 0x02;
-    writeBuf[3] = 0x80;
-    XboxCommand(controller, writeBuf, 12);
+    XboxCommand(controller, 0x00, 0x00, 0x02, 0x80);
 
     checkControllerBattery(controller);
 
@@ -730,14 +742,9 @@ void XBOXRECV::chatPadQueueLed(uint8_t led, uint8_t controller)
 
 void XBOXRECV::chatPadProcessLed(uint8_t controller)
 {
-    if (chatPadLedQueue[controller][0] != 0xFF)
+    //An LED that doesn't go through stays at the head of the queue for the next pass
+    if (chatPadLedQueue[controller][0] != 0xFF && !XboxCommand(controller, 0x00, 0x00, 0x0C, chatPadLedQueue[controller][0]))
     {
-        memset(writeBuf, 0x00, 12);
-        writeBuf[0] = 0x00;
-        writeBuf[1] = 0x00;
-        writeBuf[2] = 0x0C;
-        writeBuf[3] = chatPadLedQueue[controller][0];
-        XboxCommand(controller, writeBuf, 12);
         chatPadLedQueue[controller][0] = chatPadLedQueue[controller][1];
         chatPadLedQueue[controller][1] = chatPadLedQueue[controller][2];
         chatPadLedQueue[controller][2] = chatPadLedQueue[controller][3];
@@ -41,72 +41,10 @@
 
 #define XBOX_MAX_ENDPOINTS 17
 
-enum ChatPadButton
-{
-        //Offset byte 26 or 27. You can get 2 buttons are once on the chatpad,
-        CHATPAD_1 = 23,
-        CHATPAD_2 = 22,
-        CHATPAD_3 = 21,
-        CHATPAD_4 = 20,
-        CHATPAD_5 = 19,
-        CHATPAD_6 = 18,
-        CHATPAD_7 = 17,
-        CHATPAD_8 = 103,
-        CHATPAD_9 = 102,
-        CHATPAD_0 = 101,
-
-        CHATPAD_Q = 39,
-        CHATPAD_W = 38,
-        CHATPAD_E = 37,
-        CHATPAD_R = 36,
-        CHATPAD_T = 35,
-        CHATPAD_Y = 34,
-        CHATPAD_U = 33,
-        CHATPAD_I = 118,
-        CHATPAD_O = 117,
-        CHATPAD_P = 100,
-
-        CHATPAD_A = 55,
-        CHATPAD_S = 54,
-        CHATPAD_D = 53,
-        CHATPAD_F = 52,
-        CHATPAD_G = 51,
-        CHATPAD_H = 50,
-        CHATPAD_J = 49,
-        CHATPAD_K = 119,
-        CHATPAD_L = 114,
-        CHATPAD_COMMA = 98,
-
-        CHATPAD_Z = 70,
-        CHATPAD_X = 69,
-        CHATPAD_C = 68,
-        CHATPAD_V = 67,
-        CHATPAD_B = 66,
-        CHATPAD_N = 65,
-        CHATPAD_M = 82,
-        CHATPAD_PERIOD = 83,
-        CHATPAD_ENTER = 99,
-
-        CHATPAD_LEFT = 85,
-        CHATPAD_SPACE = 84,
-        CHATPAD_RIGHT = 81,
-        CHATPAD_BACK = 113,
-
-        //Offset byte 25,
-        CHATPAD_SHIFT = 1,
-        CHATPAD_GREEN = 2,
-        CHATPAD_ORANGE = 4,
-        CHATPAD_MESSENGER = 8,
-};
-
-#define CHATPAD_LED_CAPSLOCK_OFF 0x00
-#define CHATPAD_LED_GREEN_OFF 0x01
-#define CHATPAD_LED_ORANGE_OFF 0x02
-#define CHATPAD_LED_MESSENGER_OFF 0x03
-#define CHATPAD_LED_CAPSLOCK_ON 0x08
-#define CHATPAD_LED_GREEN_ON 0x09
-#define CHATPAD_LED_ORANGE_ON 0x0A
-#define CHATPAD_LED_MESSENGER_ON 0x0B
+// Presence tracking of the wireless controllers, see XBOXRECV::Poll()
+#define XBOX_PRESENCE_IDLE 250       // ms a connected controller can be silent before the receiver is asked if it is still there
+#define XBOX_PRESENCE_NAK_STREAK 8   // polls of its input pipe that must have been NAKed in a row before asking
+#define XBOX_PRESENCE_MAX_PROBES 2   // the controller is lost when the receiver did not answer this many presence probes
 
 /**
  * This class implements support for a Xbox Wireless receiver.
@@ -234,8 +172,9 @@ public:
          * @param lValue     Left motor (big weight) inside the controller.
          * @param rValue     Right motor (small weight) inside the controller.
          * @param controller The controller to write to. Default to 0.
+         * @return           0 if the command was sent, the USB error code if not. Try again on a later pass.
          */
-        void setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller = 0);
+        uint8_t setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller = 0);
         /**
          * Set LED value. Without using the ::LEDEnum or ::LEDModeEnum.
          * @param value      See:
@@ -301,6 +240,30 @@ public:
         void chatPadKeepAlive2(uint8_t controller);                   //Ryzee
         uint8_t getChatPadPress(ChatPadButton b, uint8_t controller); //Ryzee
         uint8_t getChatPadClick(ChatPadButton b, uint8_t controller); //Ryzee
+
+        /**
+         * Raw button state, for reading many buttons in one go.
+         * @param  controller The controller to read from.
+         * @return            The digital buttons, the masks of the bits are in XBOX_BUTTONS.
+         */
+        uint16_t getButtonWord(uint8_t controller) {
+                return ButtonState[controller] >> 16;
+        };
+
+        /**
+         * Raw chatpad state, for reading many keys in one go.
+         * @param  controller The controller to read from.
+         * @return            The modifiers (::CHATPAD_SHIFT etc. OR'd together) in bits 16-23
+         *                    and the ::ChatPadButton codes of up to two keys in bits 8-15 and 0-7.
+         */
+        uint32_t getChatPadWord(uint8_t controller) {
+                return ChatPadState[controller];
+        };
+
+        /** True while a chatpad click hasn't been read by getChatPadClick(). */
+        bool getChatPadClicked(uint8_t controller) {
+                return ChatPadClickState[controller] != 0;
+        };
         void chatPadQueueLed(uint8_t led, uint8_t controller);        //Ryzee
         uint8_t chatPadLedQueue[4][4];                                //You can queue up 4 LED commands
         uint8_t chatPadInitNeeded[4];
@@ -354,14 +317,23 @@ private:
         uint32_t checkStatusTimer; //Timing for checkStatus() signals
         uint32_t chatPadLedTimer;  //Timing for chat pad led updates
 
+        /* Presence tracking */
+        uint32_t lastSeen[4];         // When the receiver last sent anything for the controller
+        uint32_t lastProbe[4];        // When the last presence probe was sent
+        uint8_t nakStreak[4];         // Polls of the input pipe that were NAKed in a row
+        uint8_t probesUnanswered[4];  // Presence probes sent since the receiver last sent anything
+        uint32_t outputTimer[4];      // When the last command was sent on the output pipe
+
         uint8_t readBuf[EP_MAXPKTSIZE]; // General purpose buffer for input data
         uint8_t writeBuf[12];           // General purpose buffer for output data
 
         void readReport(uint8_t controller);                  // read incoming data
+        void trackPresence(uint8_t controller, bool gotData); // detect controllers that went away
         void printReport(uint8_t controller, uint8_t nBytes); // print incoming date - Uncomment for debugging
 
         /* Private commands */
-        void XboxCommand(uint8_t controller, uint8_t *data, uint16_t nbytes);
+        uint8_t XboxCommand(uint8_t controller, uint8_t *data, uint16_t nbytes);
+        uint8_t XboxCommand(uint8_t controller, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3); // Command that is 4 bytes followed by zeros
         void chatPadProcessLed(uint8_t controller);
         //void checkStatus(); moved to public function - Ryzee
 };
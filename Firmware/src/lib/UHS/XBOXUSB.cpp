@@ -20,9 +20,9 @@ e-mail   :  kristianl@tkjelectronics.com
 //#define EXTRADEBUG // Uncomment to get even more debugging data
 //#define PRINTREPORT // Uncomment to print the report send by the Xbox 360 Controller
 
-XBOXUSB::XBOXUSB(USB *p) : pUsb(p),     // pointer to USB class instance - mandatory
-                           bAddress(0), // device address - mandatory
-                           bPollEnable(false)
+XBOXUSB::XBOXUSB(USB *p, bool bRegister) : pUsb(p), // pointer to USB class instance - mandatory
+                                           bAddress(0), // device address - mandatory
+                                           bPollEnable(false)
 { // don't start polling before dongle is connected
     for (uint8_t i = 0; i < 3; i++)
     {
@@ -33,7 +33,7 @@ XBOXUSB::XBOXUSB(USB *p) : pUsb(p),     // pointer to USB class instance - manda
         epInfo[i].bmNakPower = (i) ? USB_NAK_NOWAIT : USB_NAK_MAX_POWER;
     }
 
-    if (pUsb)                            // register in USB subsystem
+    if (pUsb && bRegister)               // register in USB subsystem
         pUsb->RegisterDeviceClass(this); //set devConfig[] entry
 }
 
@@ -47,6 +47,7 @@ uint8_t XBOXUSB::Init(uint8_t parent, uint8_t port, bool lowspeed)
     uint16_t PID;
     uint16_t VID;
     bool v114;		// 2 Wired Controller Versions: 1.10 & 1.14
+    UsbDescCacheEntry *cached = pUsb->GetCachedDevice(); // Set if this controller has been connected before
 
     // get memory address of USB device address pool
     AddressPool &addrPool = pUsb->GetAddressPool();
@@ -81,27 +82,39 @@ uint8_t XBOXUSB::Init(uint8_t parent, uint8_t port, bool lowspeed)
         return USB_ERROR_EPINFO_IS_NULL;
     }
 
-    // Save old pointer to EP_RECORD of address 0
-    oldep_ptr = p->epinfo;
+    if (cached)
+    {
+        // Known controller, the host has just read the device descriptor so don't read it again
+        udd->idVendor = cached->idVendor;
+        udd->idProduct = cached->idProduct;
+        udd->bcdDevice = cached->bcdDevice;
+        udd->bMaxPacketSize0 = cached->bMaxPacketSize0;
+    }
+    else
+    {
+        // Save old pointer to EP_RECORD of address 0
+        oldep_ptr = p->epinfo;
 
-    // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
-    p->epinfo = epInfo;
+        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
+        p->epinfo = epInfo;
 
-    p->lowspeed = lowspeed;
+        p->lowspeed = lowspeed;
+
+        // Get device descriptor
+        rcode = pUsb->getDevDescr(0, 0, sizeof(USB_DEVICE_DESCRIPTOR), (uint8_t *)buf);
+
+        // Restore p->epinfo
+        p->epinfo = oldep_ptr;
+
+        if (rcode)
+            goto FailGetDevDescr;
+    }
 
-    // Get device descriptor
-    rcode = pUsb->getDevDescr(0, 0, sizeof(USB_DEVICE_DESCRIPTOR), (uint8_t *)buf);
     if (udd->bcdDevice == 0x114)
         v114 = true;
     else
         v114 = false;
 
-    // Restore p->epinfo
-    p->epinfo = oldep_ptr;
-
-    if (rcode)
-        goto FailGetDevDescr;
-
     VID = udd->idVendor;
     PID = udd->idProduct;
 
@@ -118,7 +131,7 @@ uint8_t XBOXUSB::Init(uint8_t parent, uint8_t port, bool lowspeed)
     epInfo[0].maxPktSize = udd->bMaxPacketSize0;
 
     // Assign new address to the device
-    rcode = pUsb->setAddr(0, 0, bAddress);
+    rcode = pUsb->setAddr(0, 0, bAddress, USB_SETADDR_DELAY);
     if (rcode)
     {
         p->lowspeed = false;
@@ -172,7 +185,7 @@ uint8_t XBOXUSB::Init(uint8_t parent, uint8_t port, bool lowspeed)
     if (rcode)
         goto FailSetDevTblEntry;
 
-    delay(200); // Give time for address change
+    pUsb->enumDelay(200); // Give time for address change
 
     rcode = pUsb->setConf(bAddress, epInfo[XBOX_CONTROL_PIPE].epAddr, 1);
     if (rcode)
@@ -235,7 +248,7 @@ uint8_t XBOXUSB::Poll()
     if (!bPollEnable)
         return 0;
     uint16_t BUFFER_SIZE = EP_MAXPKTSIZE;
-    pUsb->inTransfer(bAddress, epInfo[XBOX_INPUT_PIPE].epAddr, &BUFFER_SIZE, readBuf); // input on endpoint 1
+    pUsb->inTransfer(bAddress, epInfo[XBOX_INPUT_PIPE].epAddr, &BUFFER_SIZE, readBuf, 0, USB_POLL_BUDGET); // input on endpoint 1
     readReport();
 #ifdef PRINTREPORT
     printReport(); // Uncomment "#define PRINTREPORT" to print the report send by the Xbox 360 Controller
@@ -325,28 +338,22 @@ int16_t XBOXUSB::getAnalogHat(AnalogHatEnum a)
 }
 
 /* Xbox Controller commands */
-void XBOXUSB::XboxCommand(uint8_t *data, uint16_t nbytes)
+//Sends one command. The OUT transfer and the read back of the answer are each limited by their
+//budget, a command that doesn't go through returns the USB error code for the caller to retry.
+uint8_t XBOXUSB::XboxCommand(uint8_t *data, uint16_t nbytes)
 {
-    uint32_t timeout;
-
-    uint8_t rcode = hrNAK;
     while (millis() - outPipeTimer < 2);
 
-    timeout= millis();
-    while (rcode != hrSUCCESS && (millis() - timeout) < 50)
-        rcode = pUsb->outTransfer(bAddress, epInfo[XBOX_OUTPUT_PIPE].epAddr, nbytes, data);
-
-    //Readback any response
-    rcode = hrSUCCESS;
-    timeout = millis();
-    while (rcode != hrNAK && (millis() - timeout) < 50)
-    {
-        uint16_t bufferSize = EP_MAXPKTSIZE;
-        rcode = pUsb->inTransfer(bAddress, epInfo[XBOX_INPUT_PIPE].epAddr, &bufferSize, readBuf);
-        if (bufferSize > 0)
-            readReport();
-    }
+    uint8_t rcode = pUsb->outTransfer(bAddress, epInfo[XBOX_OUTPUT_PIPE].epAddr, nbytes, data, USB_OUT_BUDGET);
     outPipeTimer = millis();
+    if (rcode)
+        return rcode;
+
+    //Readback any response, anything more comes with the next Poll()
+    uint16_t bufferSize = EP_MAXPKTSIZE;
+    if (pUsb->inTransfer(bAddress, epInfo[XBOX_INPUT_PIPE].epAddr, &bufferSize, readBuf, 0, USB_POLL_BUDGET) == hrSUCCESS && bufferSize > 0)
+        readReport();
+    return 0;
 }
 
 void XBOXUSB::setLedRaw(uint8_t value)
@@ -376,7 +383,7 @@ void XBOXUSB::setLedMode(LEDModeEnum ledMode)
     setLedRaw((uint8_t)ledMode);
 }
 
-void XBOXUSB::setRumbleOn(uint8_t lValue, uint8_t rValue)
+uint8_t XBOXUSB::setRumbleOn(uint8_t lValue, uint8_t rValue)
 {
     writeBuf[0] = 0x00;
     writeBuf[1] = 0x08;
@@ -387,7 +394,7 @@ void XBOXUSB::setRumbleOn(uint8_t lValue, uint8_t rValue)
     writeBuf[6] = 0x00;
     writeBuf[7] = 0x00;
 
-    XboxCommand(writeBuf, 8);
+    return XboxCommand(writeBuf, 8);
 }
 
 void XBOXUSB::onInit()
@@ -70,9 +70,10 @@ class XBOXUSB : public USBDeviceConfig
 public:
     /**
      * Constructor for the XBOXUSB class.
-     * @param  pUsb   Pointer to USB class instance.
+     * @param  pUsb      Pointer to USB class instance.
+     * @param  bRegister False if the instance is owned by a UsbDriverSlot, which registers itself instead.
      */
-    XBOXUSB(USB *pUsb);
+    XBOXUSB(USB *pUsb, bool bRegister = true);
 
     /** @name USBDeviceConfig implementation */
     /**
@@ -119,6 +120,12 @@ public:
      * @return     Returns true if the device's VID and PID matches this driver.
      */
     virtual bool VIDPIDOK(uint16_t vid, uint16_t pid)
+    {
+        return VIDPIDMatch(vid, pid);
+    };
+
+    /** Same as VIDPIDOK(), usable before there is an instance. */
+    static bool VIDPIDMatch(uint16_t vid, uint16_t pid)
     {
         return ((vid == MICROSOFT_VID ||
                  vid == HARMONIX_VID ||
@@ -188,8 +195,9 @@ public:
      * Turn rumble on.
      * @param lValue     Left motor (big weight) inside the controller.
      * @param rValue     Right motor (small weight) inside the controller.
+     * @return           0 if the command was sent, the USB error code if not. Try again on a later pass.
      */
-    void setRumbleOn(uint8_t lValue, uint8_t rValue);
+    uint8_t setRumbleOn(uint8_t lValue, uint8_t rValue);
     /**
      * Set LED value. Without using the ::LEDEnum or ::LEDModeEnum.
      * @param value      See:
@@ -271,6 +279,6 @@ private:
     void printReport(); // print incoming date - Uncomment for debugging
 
     /* Private commands */
-    void XboxCommand(uint8_t *data, uint16_t nbytes);
+    uint8_t XboxCommand(uint8_t *data, uint16_t nbytes);
 };
 #endif
@@ -0,0 +1,95 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web   : http://www.circuitsathome.com
+e-mail  : support@circuitsathome.com
+ */
+
+#if !defined(_usb_h_) || defined(__DESCCACHE_H__)
+#error "Never include desccache.h directly; include Usb.h instead"
+#else
+#define __DESCCACHE_H__
+
+/* Descriptor cache. Remembers what was learnt about devices that enumerated successfully before, keyed by VID/PID. */
+/* When the same device is plugged in again it is offered to the drivers in the usual order, so it goes to the    */
+/* first free one that takes its VID/PID just like a new device. That driver can then skip reading the           */
+/* descriptors again and go straight to SetConfiguration. The settle times after SetAddress and                 */
+/* SetConfiguration are what the device needs, they stay the same.                                               */
+#define USB_DESC_CACHE_SIZE             4       // number of devices remembered
+#define USB_DESC_CACHE_MAX_EP           2       // endpoints remembered per device, not counting the control endpoint
+
+struct UsbDescCacheEntry {
+        uint16_t idVendor; // 0 if this entry is free
+        uint16_t idProduct;
+        uint16_t bcdDevice; // A different firmware revision of the device is treated as a new device
+        uint8_t bMaxPacketSize0;
+        uint8_t bConfNum; // Configuration value used with SetConfiguration
+        uint8_t bInterval; // Largest polling interval of the endpoints
+        uint8_t bNumEP; // Number of valid entries in epAddr/epMaxPktSize
+        uint8_t epAddr[USB_DESC_CACHE_MAX_EP]; // bEndpointAddress, including the direction bit
+        uint8_t epMaxPktSize[USB_DESC_CACHE_MAX_EP];
+} __attribute__((packed));
+
+class UsbDescCache {
+        UsbDescCacheEntry entries[USB_DESC_CACHE_SIZE];
+        uint8_t bNextEvict; // Round robin replacement once all entries are used
+
+public:
+
+        UsbDescCache() {
+                Clear();
+        };
+
+        void Clear() {
+                memset(entries, 0, sizeof (entries));
+                bNextEvict = 0;
+        };
+
+        UsbDescCacheEntry* Lookup(uint16_t vid, uint16_t pid) {
+                for(uint8_t i = 0; i < USB_DESC_CACHE_SIZE; i++)
+                        if(entries[i].idVendor && entries[i].idVendor == vid && entries[i].idProduct == pid)
+                                return &entries[i];
+                return NULL;
+        };
+
+        /* Returns the entry for the device, allocating a cleared one if it is not known yet. */
+        /* The caller fills in what it knows.                                                 */
+        UsbDescCacheEntry* Store(uint16_t vid, uint16_t pid) {
+                UsbDescCacheEntry *e = Lookup(vid, pid);
+
+                if(!e) {
+                        for(uint8_t i = 0; i < USB_DESC_CACHE_SIZE; i++)
+                                if(!entries[i].idVendor) {
+                                        e = &entries[i];
+                                        break;
+                                }
+                        if(!e) {
+                                e = &entries[bNextEvict];
+                                bNextEvict = (bNextEvict + 1) % USB_DESC_CACHE_SIZE;
+                        }
+                        memset(e, 0, sizeof (UsbDescCacheEntry));
+                        e->idVendor = vid;
+                        e->idProduct = pid;
+                }
+                return e;
+        };
+
+        void Invalidate(uint16_t vid, uint16_t pid) {
+                UsbDescCacheEntry *e = Lookup(vid, pid);
+
+                if(e)
+                        memset(e, 0, sizeof (UsbDescCacheEntry));
+        };
+};
+
+#endif // __DESCCACHE_H__
@@ -18,6 +18,9 @@ e-mail   :  support@circuitsathome.com
 #ifndef USB_HOST_SHIELD_SETTINGS_H
 #define USB_HOST_SHIELD_SETTINGS_H
 #include "macros.h"
+// The ogx360 settings. Every file of the host stack has to see the USB_NUMDRIVERS main.cpp sees,
+// it sizes class USB.
+#include "../../settings.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // SPI Configuration
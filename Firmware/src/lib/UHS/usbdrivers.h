@@ -0,0 +1,60 @@
+/*
+ * usbdrivers.h
+ *
+ * Compile time list of the device drivers a sketch runs.
+ *
+ * USB::Task() polls every driver in devConfig[] through the virtual USBDeviceConfig::Poll().
+ * A sketch that knows its drivers at build time can list them in a UsbDriverList instead:
+ *
+ *   static constexpr UsbDriverList<USBHub, XBOXRECV> usbDrivers(&Hub, &Xbox360Wireless);
+ *   static void pollDrivers() { usbDrivers.Poll(); }
+ *   ...
+ *   UsbHost.attachDriverPoll(pollDrivers);
+ *
+ * Poll() calls each driver's own Poll() by its class name, so the calls are direct (and can be
+ * inlined) instead of going through the vtable, and there are no empty slots to skip. A
+ * constexpr list holds no state, the driver addresses end up in the code.
+ *
+ * The drivers still register themselves with RegisterDeviceClass(), enumeration and release
+ * go through devConfig[] as before. Set USB_NUMDRIVERS to UsbDriverList::count so that table
+ * is no bigger than it has to be.
+ */
+
+#if !defined(__USBDRIVERS_H__)
+#define __USBDRIVERS_H__
+
+#include "Usb.h"
+
+template<class... Drivers> class UsbDriverList;
+
+template<> class UsbDriverList<> {
+public:
+        static const uint8_t count = 0;
+
+        constexpr UsbDriverList() {
+        };
+
+        uint8_t Poll() const {
+                return 0;
+        };
+};
+
+template<class Driver, class... Others> class UsbDriverList<Driver, Others...> {
+        Driver *pDriver;
+        UsbDriverList<Others...> others;
+
+public:
+        static const uint8_t count = 1 + UsbDriverList<Others...>::count;
+
+        constexpr UsbDriverList(Driver *driver, Others *... rest) : pDriver(driver), others(rest...) {
+        };
+
+        /** @return The Poll() result of the first driver that failed, 0 if they all succeeded. */
+        uint8_t Poll() const {
+                uint8_t rcode = pDriver->Driver::Poll();
+                uint8_t rcodeOthers = others.Poll();
+                return rcode ? rcode : rcodeOthers;
+        };
+};
+
+#endif // __USBDRIVERS_H__
@@ -0,0 +1,177 @@
+/*
+ * usbdriverslot.h
+ *
+ * Room for one driver out of a list of driver classes, created when a device is plugged in.
+ *
+ * A sketch that supports several kinds of device but only ever has a few of them plugged in
+ * at once doesn't have to construct an instance of every driver for every device it could see.
+ * A UsbDriverSlot registers itself with the USB core in place of the drivers. When the core
+ * offers it a device, the first class in Drivers whose VIDPIDMatch() takes the VID and PID is
+ * constructed inside the slot and configures the device. When the device is released the
+ * driver is destroyed and the slot can take any of the drivers again. A slot is the size of
+ * the biggest driver in the list.
+ *
+ * The drivers need a static VIDPIDMatch(vid, pid) and a constructor (USB *pUsb, bool bRegister)
+ * that doesn't register the instance when bRegister is false.
+ *
+ *   UsbDriverSlot<XBOXONE, XBOXUSB> WiredSlot(&UsbHost);
+ *   ...
+ *   XBOXONE *pad = WiredSlot.Get<XBOXONE>(); // NULL unless a Xbox One controller is in it
+ *
+ * Poll() calls the driver's Poll() by its class name, so a slot can be put in a UsbDriverList.
+ * It also overrides USBDeviceConfig::Poll(), so the slot's driver is polled through devConfig[]
+ * when no driver list is attached.
+ */
+
+#if !defined(__USBDRIVERSLOT_H__)
+#define __USBDRIVERSLOT_H__
+
+#include <new.h>
+#include "Usb.h"
+
+template<class A, class B> struct UsbSameClass {
+        static const bool value = false;
+};
+
+template<class A> struct UsbSameClass<A, A> {
+        static const bool value = true;
+};
+
+// Operations on the driver in a slot, selected by its kind: 1 + its index in the list, 0 for none
+template<uint8_t Kind, class... Drivers> struct UsbDriverSlotOps;
+
+template<uint8_t Kind> struct UsbDriverSlotOps<Kind> {
+        static const size_t size = 0;
+
+        template<class T> static uint8_t KindOf() {
+                return 0;
+        };
+
+        static uint8_t Match(uint16_t vid __attribute__((unused)), uint16_t pid __attribute__((unused))) {
+                return 0;
+        };
+
+        static void Construct(uint8_t kind __attribute__((unused)), void *p __attribute__((unused)), USB *pUsb __attribute__((unused))) {
+        };
+
+        static void Destroy(uint8_t kind __attribute__((unused)), void *p __attribute__((unused))) {
+        };
+
+        static USBDeviceConfig* Config(uint8_t kind __attribute__((unused)), void *p __attribute__((unused))) {
+                return NULL;
+        };
+
+        static uint8_t Poll(uint8_t kind __attribute__((unused)), void *p __attribute__((unused))) {
+                return 0;
+        };
+};
+
+template<uint8_t Kind, class Driver, class... Others> struct UsbDriverSlotOps<Kind, Driver, Others...> {
+        typedef UsbDriverSlotOps<Kind + 1, Others...> Next;
+
+        static const size_t size = sizeof (Driver) > Next::size ? sizeof (Driver) : Next::size;
+
+        template<class T> static uint8_t KindOf() {
+                return UsbSameClass<T, Driver>::value ? Kind : Next::template KindOf<T>();
+        };
+
+        static uint8_t Match(uint16_t vid, uint16_t pid) {
+                return Driver::VIDPIDMatch(vid, pid) ? Kind : Next::Match(vid, pid);
+        };
+
+        static void Construct(uint8_t kind, void *p, USB *pUsb) {
+                if(kind == Kind)
+                        new(p) Driver(pUsb, false);
+                else
+                        Next::Construct(kind, p, pUsb);
+        };
+
+        static void Destroy(uint8_t kind, void *p) {
+                if(kind == Kind)
+                        static_cast<Driver*>(p)->~Driver();
+                else
+                        Next::Destroy(kind, p);
+        };
+
+        static USBDeviceConfig* Config(uint8_t kind, void *p) {
+                return kind == Kind ? static_cast<Driver*>(p) : Next::Config(kind, p);
+        };
+
+        static uint8_t Poll(uint8_t kind, void *p) {
+                return kind == Kind ? static_cast<Driver*>(p)->Driver::Poll() : Next::Poll(kind, p);
+        };
+};
+
+template<class... Drivers> class UsbDriverSlot : public USBDeviceConfig {
+        typedef UsbDriverSlotOps<1, Drivers...> Ops;
+
+        USB *pUsb;
+        uint8_t bKind; // Kind of the driver in the slot, 0 while it is free
+        uint8_t storage[Ops::size] __attribute__((aligned));
+
+        USBDeviceConfig* Driver() {
+                return Ops::Config(bKind, storage);
+        };
+
+        void Free() {
+                Ops::Destroy(bKind, storage);
+                bKind = 0;
+        };
+
+public:
+        UsbDriverSlot(USB *p) : pUsb(p), bKind(0) {
+                if(pUsb) // register in USB subsystem
+                        pUsb->RegisterDeviceClass(this); //set devConfig[] entry
+        };
+
+        /** @return The driver in the slot if it is a T, otherwise NULL. */
+        template<class T> T* Get() {
+                return (bKind && bKind == Ops::template KindOf<T>()) ? reinterpret_cast<T*>(storage) : NULL;
+        };
+
+        /** @name USBDeviceConfig implementation */
+        virtual uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed) {
+                if(!bKind) {
+                        bKind = Ops::Match(pUsb->GetConfiguringVID(), pUsb->GetConfiguringPID());
+                        if(!bKind)
+                                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+                        Ops::Construct(bKind, storage, pUsb);
+                }
+                uint8_t rcode = Driver()->ConfigureDevice(parent, port, lowspeed);
+                if(rcode && rcode != USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET)
+                        Free(); // Init() won't be called
+                return rcode;
+        };
+
+        virtual uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed) {
+                if(!bKind)
+                        return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+                uint8_t rcode = Driver()->Init(parent, port, lowspeed);
+                if(rcode && !Driver()->GetAddress())
+                        Free(); // The driver gave up and has already released the device
+                return rcode;
+        };
+
+        virtual uint8_t Release() {
+                if(!bKind)
+                        return 0;
+                uint8_t rcode = Driver()->Release();
+                Free();
+                return rcode;
+        };
+
+        virtual uint8_t Poll() {
+                return Ops::Poll(bKind, storage);
+        };
+
+        virtual uint8_t GetAddress() {
+                return bKind ? Driver()->GetAddress() : 0;
+        };
+
+        virtual bool VIDPIDOK(uint16_t vid, uint16_t pid) {
+                return bKind ? Driver()->VIDPIDOK(vid, pid) : Ops::Match(vid, pid) != 0;
+        };
+        /**@}*/
+};
+
+#endif // __USBDRIVERSLOT_H__
@@ -24,7 +24,12 @@ bAddress(0),
 bNbrPorts(0),
 //bInitState(0),
 qNextPollTime(0),
-bPollEnable(false) {
+bPollEnable(false),
+qNextSweepTime(0),
+bSweepPort(1),
+bPendingPort(0),
+bPendingLowSpeed(false),
+qPendingTime(0) {
         epInfo[0].epAddr = 0;
         epInfo[0].maxPktSize = 8;
         epInfo[0].bmSndToggle = 0;
@@ -223,6 +228,8 @@ uint8_t USBHub::Release() {
         bNbrPorts = 0;
         qNextPollTime = 0;
         bPollEnable = false;
+        bSweepPort = 1;
+        bPendingPort = 0;
         return 0;
 }
 
@@ -232,9 +239,32 @@ uint8_t USBHub::Poll() {
         if(!bPollEnable)
                 return 0;
 
+        // Port changes are picked up on a later poll, so a new device is never
+        // started while another one is still being enumerated.
+        if(pUsb->isEnumerating())
+                return 0;
+
+        // A port finished its reset on an earlier poll, configure the device once it has settled.
+        if(bPendingPort) {
+                if((int32_t)((uint32_t)millis() - qPendingTime) < 0L)
+                        return 0;
+
+                uint8_t port = bPendingPort;
+                bPendingPort = 0;
+
+                UsbDeviceAddress a;
+                a.devAddress = bAddress;
+                rcode = pUsb->Configuring(a.bmAddress, port, bPendingLowSpeed);
+                if(rcode && rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE)
+                        pUsb->ReportFault(a.bmAddress, port, bPendingLowSpeed);
+                bResetInitiated = false;
+                return 0;
+        }
+
         if(((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L)) {
                 rcode = CheckHubStatus();
-                qNextPollTime = (uint32_t)millis() + 100;
+                // Look for the end of a port reset sooner than the normal interval
+                qNextPollTime = (uint32_t)millis() + ((bResetInitiated) ? HUB_RESET_POLL_INTERVAL : HUB_POLL_INTERVAL);
         }
         return rcode;
 }
@@ -244,7 +274,12 @@ uint8_t USBHub::CheckHubStatus() {
         uint8_t buf[8];
         uint16_t read = 1;
 
-        rcode = pUsb->inTransfer(bAddress, 1, &read, buf);
+        rcode = pUsb->inTransfer(bAddress, 1, &read, buf, 0, USB_POLL_BUDGET);
+
+        // The hub NAKs its interrupt endpoint when nothing changed. Use the idle time to
+        // check a port for being disabled now and then.
+        if(rcode == hrNAK)
+                return SweepDisabledPort();
 
         if(rcode)
                 return rcode;
@@ -260,7 +295,8 @@ uint8_t USBHub::CheckHubStatus() {
         //                return rcode;
         //        }
         //}
-        for(uint8_t port = 1, mask = 0x02; port < 8; mask <<= 1, port++) {
+        // Only the ports flagged in the status change bitmap are read
+        for(uint8_t port = 1, mask = 0x02; port < 8 && port <= bNbrPorts; mask <<= 1, port++) {
                 if(buf[0] & mask) {
                         HubEvent evt;
                         evt.bmEvent = 0;
@@ -279,31 +315,42 @@ uint8_t USBHub::CheckHubStatus() {
                                 return rcode;
                 }
         } // for
+        return 0;
+}
 
-        for(uint8_t port = 1; port <= bNbrPorts; port++) {
-                HubEvent evt;
-                evt.bmEvent = 0;
+// A device can be left on a port that is connected but disabled, for instance when its
+// enumeration failed. The hub reports no change for such a port, so it is found by reading
+// the status of one port every HUB_SWEEP_INTERVAL instead of all of them on every poll.
+uint8_t USBHub::SweepDisabledPort() {
+        uint8_t rcode;
+        HubEvent evt;
 
-                rcode = GetPortStatus(port, 4, evt.evtBuff);
+        if(bResetInitiated || (int32_t)((uint32_t)millis() - qNextSweepTime) < 0L)
+                return 0;
 
-                if(rcode)
-                        continue;
+        qNextSweepTime = (uint32_t)millis() + HUB_SWEEP_INTERVAL;
 
-                if((evt.bmStatus & bmHUB_PORT_STATE_CHECK_DISABLED) != bmHUB_PORT_STATE_DISABLED)
-                        continue;
+        uint8_t port = bSweepPort;
+        bSweepPort = (bSweepPort < bNbrPorts) ? bSweepPort + 1 : 1;
 
-                // Emulate connection event for the port
-                evt.bmChange |= bmHUB_PORT_STATUS_C_PORT_CONNECTION;
+        evt.bmEvent = 0;
+        rcode = GetPortStatus(port, 4, evt.evtBuff);
 
-                rcode = PortStatusChange(port, evt);
+        if(rcode)
+                return 0;
 
-                if(rcode == HUB_ERROR_PORT_HAS_BEEN_RESET)
-                        return 0;
+        if((evt.bmStatus & bmHUB_PORT_STATE_CHECK_DISABLED) != bmHUB_PORT_STATE_DISABLED)
+                return 0;
 
-                if(rcode)
-                        return rcode;
-        } // for
-        return 0;
+        // Emulate connection event for the port
+        evt.bmChange |= bmHUB_PORT_STATUS_C_PORT_CONNECTION;
+
+        rcode = PortStatusChange(port, evt);
+
+        if(rcode == HUB_ERROR_PORT_HAS_BEEN_RESET)
+                return 0;
+
+        return rcode;
 }
 
 void USBHub::ResetHubPort(uint8_t port) {
@@ -316,17 +363,20 @@ void USBHub::ResetHubPort(uint8_t port) {
         SetPortFeature(HUB_FEATURE_PORT_RESET, port, 0);
 
 
-        for(int i = 0; i < 3; i++) {
+        // Only called while a device is being configured, so the other devices keep being
+        // polled while waiting for the hub to finish the reset.
+        uint32_t timeout = (uint32_t)millis() + HUB_RESET_TIMEOUT;
+        do {
+                pUsb->enumDelay(HUB_RESET_POLL_INTERVAL);
                 rcode = GetPortStatus(port, 4, evt.evtBuff);
                 if(rcode) break; // Some kind of error, bail.
                 if(evt.bmEvent == bmHUB_PORT_EVENT_RESET_COMPLETE || evt.bmEvent == bmHUB_PORT_EVENT_LS_RESET_COMPLETE) {
                         break;
                 }
-                delay(100); // simulate polling.
-        }
+        } while((int32_t)((uint32_t)millis() - timeout) < 0L);
         ClearPortFeature(HUB_FEATURE_C_PORT_RESET, port, 0);
         ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, port, 0);
-        delay(20);
+        pUsb->enumDelay(HUB_PORT_SETTLE_DELAY);
 }
 
 uint8_t USBHub::PortStatusChange(uint8_t port, HubEvent &evt) {
@@ -337,6 +387,7 @@ uint8_t USBHub::PortStatusChange(uint8_t port, HubEvent &evt) {
                         if(bResetInitiated)
                                 return 0;
 
+                        pUsb->markAttach();
                         ClearPortFeature(HUB_FEATURE_C_PORT_ENABLE, port, 0);
                         ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, port, 0);
                         SetPortFeature(HUB_FEATURE_PORT_RESET, port, 0);
@@ -355,6 +406,8 @@ uint8_t USBHub::PortStatusChange(uint8_t port, HubEvent &evt) {
                         a.bmParent = bAddress;
                         a.bmAddress = port;
                         pUsb->ReleaseDevice(a.devAddress);
+                        a.devAddress = bAddress;
+                        pUsb->ClearFault(a.bmAddress, port);
                         return 0;
 
                         // Reset complete event
@@ -363,12 +416,10 @@ uint8_t USBHub::PortStatusChange(uint8_t port, HubEvent &evt) {
                         ClearPortFeature(HUB_FEATURE_C_PORT_RESET, port, 0);
                         ClearPortFeature(HUB_FEATURE_C_PORT_CONNECTION, port, 0);
 
-                        delay(20);
-
-                        a.devAddress = bAddress;
-
-                        pUsb->Configuring(a.bmAddress, port, (evt.bmStatus & bmHUB_PORT_STATUS_PORT_LOW_SPEED));
-                        bResetInitiated = false;
+                        // Configured from Poll() once the device has settled
+                        bPendingPort = port;
+                        bPendingLowSpeed = (evt.bmStatus & bmHUB_PORT_STATUS_PORT_LOW_SPEED);
+                        qPendingTime = (uint32_t)millis() + HUB_PORT_SETTLE_DELAY;
                         break;
 
         } // switch (evt.bmEvent)
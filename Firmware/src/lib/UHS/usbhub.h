@@ -109,6 +109,13 @@ e-mail   :  support@circuitsathome.com
 #define USB_STATE_HUB_PORT_RESETTING            0xb5
 #define USB_STATE_HUB_PORT_ENABLED              0xb6
 
+// Hub timing in milliseconds
+#define HUB_POLL_INTERVAL                       100     // interrupt endpoint polling interval
+#define HUB_RESET_POLL_INTERVAL                 10      // port status polling interval while a port reset is in progress
+#define HUB_RESET_TIMEOUT                       300     // give up waiting for a port reset after this long
+#define HUB_PORT_SETTLE_DELAY                   20      // recovery time after a port reset
+#define HUB_SWEEP_INTERVAL                      1000    // one port is checked for being disabled this often
+
 // Additional Error Codes
 #define HUB_ERROR_PORT_HAS_BEEN_RESET           0xb1
 
@@ -174,7 +181,15 @@ class USBHub : USBDeviceConfig {
         uint32_t qNextPollTime; // next poll time
         bool bPollEnable; // poll enable flag
 
+        uint32_t qNextSweepTime; // next time a port is checked for being disabled
+        uint8_t bSweepPort; // next port to check for being disabled
+
+        uint8_t bPendingPort; // port whose reset completed and is waiting to be configured, 0 if none
+        bool bPendingLowSpeed; // speed of the device on bPendingPort
+        uint32_t qPendingTime; // when the device on bPendingPort has settled
+
         uint8_t CheckHubStatus();
+        uint8_t SweepDisabledPort();
         uint8_t PortStatusChange(uint8_t port, HubEvent &evt);
 
 public:
@@ -62,4 +62,72 @@ const uint16_t XBOX_BUTTONS[] PROGMEM = {
         0x0008, // SYNC
 };
 
+/** Keys and modifiers of the chatpad, see XBOXRECV::getChatPadPress() */
+enum ChatPadButton
+{
+        //Offset byte 26 or 27. You can get 2 buttons are once on the chatpad,
+        CHATPAD_1 = 23,
+        CHATPAD_2 = 22,
+        CHATPAD_3 = 21,
+        CHATPAD_4 = 20,
+        CHATPAD_5 = 19,
+        CHATPAD_6 = 18,
+        CHATPAD_7 = 17,
+        CHATPAD_8 = 103,
+        CHATPAD_9 = 102,
+        CHATPAD_0 = 101,
+
+        CHATPAD_Q = 39,
+        CHATPAD_W = 38,
+        CHATPAD_E = 37,
+        CHATPAD_R = 36,
+        CHATPAD_T = 35,
+        CHATPAD_Y = 34,
+        CHATPAD_U = 33,
+        CHATPAD_I = 118,
+        CHATPAD_O = 117,
+        CHATPAD_P = 100,
+
+        CHATPAD_A = 55,
+        CHATPAD_S = 54,
+        CHATPAD_D = 53,
+        CHATPAD_F = 52,
+        CHATPAD_G = 51,
+        CHATPAD_H = 50,
+        CHATPAD_J = 49,
+        CHATPAD_K = 119,
+        CHATPAD_L = 114,
+        CHATPAD_COMMA = 98,
+
+        CHATPAD_Z = 70,
+        CHATPAD_X = 69,
+        CHATPAD_C = 68,
+        CHATPAD_V = 67,
+        CHATPAD_B = 66,
+        CHATPAD_N = 65,
+        CHATPAD_M = 82,
+        CHATPAD_PERIOD = 83,
+        CHATPAD_ENTER = 99,
+
+        CHATPAD_LEFT = 85,
+        CHATPAD_SPACE = 84,
+        CHATPAD_RIGHT = 81,
+        CHATPAD_BACK = 113,
+
+        //Offset byte 25,
+        CHATPAD_SHIFT = 1,
+        CHATPAD_GREEN = 2,
+        CHATPAD_ORANGE = 4,
+        CHATPAD_MESSENGER = 8,
+};
+
+#define CHATPAD_LED_CAPSLOCK_OFF 0x00
+#define CHATPAD_LED_GREEN_OFF 0x01
+#define CHATPAD_LED_ORANGE_OFF 0x02
+#define CHATPAD_LED_MESSENGER_OFF 0x03
+#define CHATPAD_LED_CAPSLOCK_ON 0x08
+#define CHATPAD_LED_GREEN_ON 0x09
+#define CHATPAD_LED_ORANGE_ON 0x0A
+#define CHATPAD_LED_MESSENGER_ON 0x0B
+
 #endif
@@ -23,19 +23,17 @@ In settings.h you can configure the following options:
 */
 
 #include "settings.h"
-#include "xiddevice.h"
-#include "Wire.h"
-#include "EEPROM.h"
+#include "hal.h"
+#include "i2clink.h"
+#include "swtimer.h"
+#include "ramwatch.h"
 
 #ifdef MASTER
-#include <XBOXRECV.h>
-#include <usbhub.h>
-#ifdef SUPPORTWIREDXBOXONE
-#include <XBOXONE.h>
-#endif
-#ifdef SUPPORTWIREDXBOX360
-#include <XBOXUSB.h>
-#endif
+#include "twimaster.h"
+#include "config.h"
+#include "stick.h"
+#include "sbmap.h"
+#include "sbfeedback.h"
 #endif
 
 //playerID is set in the main program based on the slot the Arduino is installed.
@@ -47,102 +45,124 @@ uint8_t ConnectedXID = DUKE_CONTROLLER;
 //Flag is set when the device has been successfully setup by the OG Xbox
 bool enumerationComplete = false;
 //Timer used to time disconnection between SB and Duke controller swapover
-uint32_t disconnectTimer = 0;
+Timer_t disconnectTimer;
+
+void bootWait(uint32_t start, uint16_t ms);
+#if defined(ENABLE_TELEMETRY) && !defined(MASTER)
+void logLinkLatency(uint16_t latency);
+#endif
+#if defined(ENABLE_TELEMETRY) && defined(MASTER)
+void logFirstReport();
+void logTransferOverruns();
+void logRecoveries();
+void logLinkStats();
+void logRam();
+void logTelemetry(uint8_t arg);
+Timer_t telemetryTimer;
+#endif
 
 #ifdef SUPPORTBATTALION
 
 USB_XboxSteelBattalion_Data_t XboxOGSteelBattalion;
 USB_XboxSteelBattalion_Feedback_t XboxOGSteelBattalionFeedback;
+int32_t virtualMouseX = 32768, virtualMouseY = 32768;
+uint16_t virtualMouseFracX, virtualMouseFracY; //Movement of less than a count carried over, in SB_AIM_FRACs
+uint16_t virtualMouseTick;                    //timerNow() of the last aiming update
+Timer_t L3HoldTimer; //Holding the left stick in for a while centres the aiming mouse
+void swapXID(uint8_t controller);
+void centreVirtualMouse(uint8_t arg);
+uint8_t virtualMouseElapsed();
+int32_t moveVirtualMouse(int32_t pos, uint16_t *frac, int32_t step, uint8_t elapsed);
 #endif
 
 #ifdef MASTER
-USB UsbHost;
-USBHub Hub(&UsbHost);
-XBOXRECV Xbox360Wireless(&UsbHost);
-uint8_t getButtonPress(ButtonEnum b, uint8_t controller);
-int16_t getAnalogHat(AnalogHatEnum a, uint8_t controller);
-void setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller);
-void setLedOn(LEDEnum led, uint8_t controller);
-bool controllerConnected(uint8_t controller);
-#ifdef SUPPORTWIREDXBOXONE
-XBOXONE XboxOneWired1(&UsbHost);
-XBOXONE XboxOneWired2(&UsbHost);
-XBOXONE XboxOneWired3(&UsbHost);
-XBOXONE XboxOneWired4(&UsbHost);
-XBOXONE *XboxOneWired[4] = {&XboxOneWired1, &XboxOneWired2, &XboxOneWired3, &XboxOneWired4};
-#endif
-#ifdef SUPPORTWIREDXBOX360
-XBOXUSB Xbox360Wired1(&UsbHost);
-XBOXUSB Xbox360Wired2(&UsbHost);
-XBOXUSB Xbox360Wired3(&UsbHost);
-XBOXUSB Xbox360Wired4(&UsbHost);
-XBOXUSB *Xbox360Wired[4] = {&Xbox360Wired1, &Xbox360Wired2, &Xbox360Wired3, &Xbox360Wired4};
-#endif
+void serviceController(uint8_t i);
+void serviceControllersDuringEnumeration();
+void resetHostController();
+void rumbleReceived(uint8_t addr, uint8_t status, const uint8_t *data, uint8_t len);
+void commandTick(uint8_t arg);
+void powerOffController(uint8_t controller);
+//Bit per controller, set every 16ms by its commandTimer. Commands to a controller are rate limited to this.
+//The timers of the controllers are spread out over the 16ms so their commands don't all go in the same pass.
+uint8_t commandDue = 0;
+//Set while serviceControllersDuringEnumeration() runs from inside halHostTask(). Nothing may talk to
+//the MAX3421E then, commands stay due until the main loop services the controller again.
+bool insideUsbTask = false;
+Timer_t commandTimer[MAX_CONTROLLERS];
+Timer_t xboxHoldTimer[MAX_CONTROLLERS];
 #endif
 
 /*** Slave I2C Requests ***/
 #ifndef MASTER
-uint8_t inputBuffer[50]; //Input buffer used by slave devices
-//This function executes whenever a data request is sent from the I2C Master.
-//The master only requests the actuator values from the slave.
-void sendRumble()
-{
-    Wire.write(&XboxOGDuke[0].left_actuator, 1);
-    Wire.write(&XboxOGDuke[0].right_actuator, 1);
-}
+uint8_t inputBuffer[32]; //Input buffer used by slave devices
+//Controller state received from the master. The TWI interrupt builds the next state in
+//linkState[~linkSeq & 1] and then bumps linkSeq to publish it. The main loop copies
+//linkState[linkSeq & 1] and copies again if linkSeq changed meanwhile, so it never sees
+//half of one frame and half of another.
+USB_XboxGamepad_Data_t linkState[2];
+volatile uint8_t linkSeq = 0;
+volatile uint16_t linkRxTime; //halMicros() when the frame in linkState[linkSeq & 1] was received
+volatile bool linkEnabled = false; //The master has a controller for this player
+volatile bool linkPinged = false;  //A ping was received, the main loop flashes the LED
+volatile bool rumblePushNeeded = true; //Send the actuator values to the master even if they have not changed
 
 //This function executes whenever data is sent from the I2C Master.
-//The master sends either the controller state if a wireless controller
-//is synced or a disable packet {0xF0} if a controller is not synced.
+//The master sends link frames (see i2clink.h) to this slave's address and to the general call
+//address. They carry the controller state if a controller is synced, or a disabled flag if not.
 void getControllerData(int len)
 {
     for (int i = 0; i < len; i++)
     {
-        inputBuffer[i] = Wire.read();
-    }
-    //0xF0 is a packet sent from the master if the respective wireless controller isn't synced.
-    if (inputBuffer[0] == 0xF0)
-    {
-        USB_Detach();
-        digitalWrite(ARDUINO_LED_PIN, HIGH);
-    }
-    //0xAA is a ping to see if the slave module is connected
-    //Flash the LED to confirm receipt.
-    else if (inputBuffer[0] == 0xAA)
-    {
-        digitalWrite(ARDUINO_LED_PIN, LOW);
-        delay(250);
-        digitalWrite(ARDUINO_LED_PIN, HIGH);
+        inputBuffer[i] = halTwiSlaveRead();
     }
-    else
+
+    //A delta frame only carries the words that changed, so start from the current state.
+    USB_XboxGamepad_Data_t *back = &linkState[~linkSeq & 1];
+    memcpy(back, &linkState[linkSeq & 1], sizeof(USB_XboxGamepad_Data_t));
+
+    //Attaching to the OG Xbox and the LED are left to the main loop, which acts on changes only.
+    switch (linkReceive(playerID, inputBuffer, len, back))
     {
-        USB_Attach();
-        if (enumerationComplete)
-            digitalWrite(ARDUINO_LED_PIN, LOW);
+    case LINK_RX_DISABLE:
+        linkEnabled = false;
+        rumblePushNeeded = true;
+        break;
+    //A ping to see if the slave module is connected
+    case LINK_RX_PING:
+        linkPinged = true;
+        break;
+    case LINK_RX_STATE:
+        linkEnabled = true;
+        linkRxTime = halMicros();
+        linkSeq++;
+        break;
+    default:
+        break; //Rejected, counted in the link stats
     }
 }
 #endif
 /*** End Slave I2C Requests ***/
 
-int main(void)
+void firmwareBegin()
 {
-    //Init the Arduino Library
-    init();
+    halBegin();
 
     //Init IO
-    pinMode(USB_HOST_RESET_PIN, OUTPUT);
-    pinMode(ARDUINO_LED_PIN, OUTPUT);
-    pinMode(PLAYER_ID1_PIN, INPUT_PULLUP);
-    pinMode(PLAYER_ID2_PIN, INPUT_PULLUP);
-    digitalWrite(USB_HOST_RESET_PIN, LOW);
-    digitalWrite(ARDUINO_LED_PIN, HIGH);
+    halPinMode(USB_HOST_RESET_PIN, HAL_OUTPUT);
+    halPinMode(ARDUINO_LED_PIN, HAL_OUTPUT);
+    halPinMode(PLAYER_ID1_PIN, HAL_INPUT_PULLUP);
+    halPinMode(PLAYER_ID2_PIN, HAL_INPUT_PULLUP);
+    halPinWrite(USB_HOST_RESET_PIN, HAL_LOW);
+    halPinWrite(ARDUINO_LED_PIN, HAL_HIGH);
+    //The USB host controller is held in reset from here, the reset pulse runs while the rest is set up.
+    uint32_t hostResetStart = halMillis();
 
-    //Init the LUFA USB Device Library
-    SetupHardware();
-    GlobalInterruptEnable();
+    halXidBegin();
 
     //Initialise the Serial Port
-    //Serial1.begin(500000);
+#ifdef ENABLE_TELEMETRY
+    halLogBegin();
+#endif
 
     //Determine what player this board is. Used for the slave devices mainly.
     //There is 2 ID pins on the PCB which are read in.
@@ -150,7 +170,7 @@ int main(void)
     //01 = Player 2
     //10 = Player 3
     //11 = Player 4
-    playerID = digitalRead(PLAYER_ID1_PIN) << 1 | digitalRead(PLAYER_ID2_PIN);
+    playerID = halPinRead(PLAYER_ID1_PIN) << 1 | halPinRead(PLAYER_ID2_PIN);
 
     //Init the XboxOG data arrays to zero.
     memset(&XboxOGDuke, 0x00, sizeof(USB_XboxGamepad_Data_t) * MAX_CONTROLLERS);
@@ -159,52 +179,51 @@ int main(void)
 #ifdef MASTER
 
     //Init Usb Host Controller
-    digitalWrite(USB_HOST_RESET_PIN, LOW);
-    delay(20); //wait 20ms to reset the IC. Reseting at startup improves reliability in my experience.
-    digitalWrite(USB_HOST_RESET_PIN, HIGH);
-    delay(20); //Settle
-    while (UsbHost.Init() == -1)
+    //The OG Xbox enumerates the device side while the host side is brought up, so
+    //all waits here keep the LUFA stack serviced instead of blocking it.
+    bootWait(hostResetStart, 20); //hold reset for 20ms. Reseting at startup improves reliability in my experience.
+    halPinWrite(USB_HOST_RESET_PIN, HAL_HIGH);
+    //No extra settle time is needed, halHostBegin() resets the chip and waits for its oscillator itself.
+    //Connected controllers are kept alive while a newly plugged in device is enumerating.
+    //The last resort of the USB fault recovery is a hard reset of the MAX3421E.
+    while (!halHostBegin(serviceControllersDuringEnumeration, resetHostController))
     {
-        digitalWrite(ARDUINO_LED_PIN, !digitalRead(ARDUINO_LED_PIN));
-        delay(500);
+        halPinWrite(ARDUINO_LED_PIN, !halPinRead(ARDUINO_LED_PIN));
+        bootWait(halMillis(), 500);
     }
 
-    //Init I2C Master
-    Wire.begin();
-    Wire.setClock(400000);
-
-    //Ping slave devices if present
-    //This will cause them to blink
-    for (uint8_t i = 1; i < MAX_CONTROLLERS; i++)
+    //Start the 1ms timer tick and the timers that run for as long as the master is on.
+    timerBegin();
+    for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
     {
-        static const char ping[] = {(char)0xAA};
-        Wire.beginTransmission(i);
-        Wire.write(ping, 1);
-        Wire.endTransmission(true);
-        delay(100);
+        timerStart(&commandTimer[i], 16 + i * (16 / MAX_CONTROLLERS), 16, commandTick, i);
     }
+#ifdef ENABLE_TELEMETRY
+    timerStart(&telemetryTimer, 1000, 1000, logTelemetry, 0);
+#endif
+
+    //Init I2C Master. Transfers to the slaves are queued and sent from the TWI interrupt.
+    twiBegin(400000);
+    twiListen(LINK_MASTER_ADDR, rumbleReceived); //The slaves write their rumble values to us
 
-    //Init all chatpad led FIFO queues 0xFF means empty spot.
-    for (uint8_t i = 0; i < 4; i++)
+    //Ping slave devices if present
+    //This will cause them to blink. Each slave times its own blink so there is no need to wait between them.
+    for (uint8_t i = 1; i < MAX_CONTROLLERS; i++)
     {
-        Xbox360Wireless.chatPadLedQueue[i][0] = 0xFF;
-        Xbox360Wireless.chatPadLedQueue[i][1] = 0xFF;
-        Xbox360Wireless.chatPadLedQueue[i][2] = 0xFF;
-        Xbox360Wireless.chatPadLedQueue[i][3] = 0xFF;
-        Xbox360Wireless.chatPadInitNeeded[i] = 1;
+        linkSendPing(i);
     }
-#endif
 
+    //Load the user settings, e.g. the Steel Battalion sensitivity
+    configBegin();
+    stickBegin();
 #ifdef SUPPORTBATTALION
-    //Setup EEPROM for variable sensitivity adjustment for SB controller.
-    static int32_t sensitivity = 400;
-    if (EEPROM.read(0x20) != 0xAB)
-    {
-        //Address 0x20 should contain 0xAB if it is initialized properly. If not, write it then set a default value below:
-        EEPROM.write(0x20, 0xAB);
-        //First time setup default EEPROM register. Address 0x00 contains the sensitivity value.
-        EEPROM.put(0x00, sensitivity);
-    }
+    sbMapBegin();
+#endif
+#ifdef ENABLE_TELEMETRY
+    halLog(PSTR("\r\nStick shaping: "));
+    halLogNum(stickBenchmark());
+    halLog(PSTR(" cycles"));
+#endif
 #endif
 
 /* END MASTER DEVICE USB HOST CONTROLLER INIT */
@@ -212,725 +231,757 @@ int main(void)
 /* SLAVE I2C SLAVE INIT */
 #ifndef MASTER
     //Init I2C Slave
-    Wire.begin(playerID); //I2C Address is 0x01,0x02,0x03 for Player 2,3 and 4 respectively.
-    Wire.setClock(400000);
-    Wire.onRequest(sendRumble);        //Register event for sendRumble. The host only requests actuator values.
-    Wire.onReceive(getControllerData); //Register receive event for getting Xbox360 controller state data.
-    Serial1.print(F("\r\nThis is a slave device"));
+    //I2C Address is 0x01,0x02,0x03 for Player 2,3 and 4 respectively. The delta frames the master sends
+    //to the general call address are received too.
+    halTwiSlaveBegin(playerID, getControllerData); //Register receive event for getting Xbox360 controller state data.
+    halLog(PSTR("\r\nThis is a slave device"));
 #endif
     /* END SLAVE I2C SLAVE INIT */
+}
+
+//One pass of the main loop.
+void firmwareTask()
+{
+#ifdef MASTER
+    /*** MASTER TASKS ***/
+    halHostProbe();
+
+    for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        halHostTask();
+        serviceController(i);
+    } //End master for loop
+    timerTask();
+    linkFlush();
+    twiTask();
+
+#ifdef ENABLE_TELEMETRY
+    logRecoveries();
+#endif
 
-    while (1)
+    //Handle Player 1 controller connect/disconnect events.
+    if (halPadConnected(0) && !timerActive(&disconnectTimer))
+    {
+        halXidAttach();
+        if (enumerationComplete)
+        {
+            halPinWrite(ARDUINO_LED_PIN, HAL_LOW);
+        }
+    }
+    else if (halMillis() > BOOT_ATTACH_WINDOW)
     {
+        halPinWrite(ARDUINO_LED_PIN, HAL_HIGH);
+        halXidDetach(); //Disconnect from the OG Xbox port.
+        halPadChatPadInit(0);
+    }
+    else
+    {
+        halXidAttach();
+        sendControllerHIDReport();
+    }
+
+/***END MASTER TASKS ***/
+#endif
+
+    //THPS 2X is the only game I know that sends rumble commands to the USB OUT pipe
+    //instead of the control pipe. So unfortunately need to manually read the out pipe
+    //and update rumble values as needed!
+    static uint8_t report[6];
+    if (halXidReadOut(0x02, report, 6)) //0x02 is the out endpoint address for the Duke Controller
+    {
+        if (report[1] == 0x06)
+        {
+            XboxOGDuke[0].left_actuator = report[3];
+            XboxOGDuke[0].right_actuator = report[5];
+            XboxOGDuke[0].rumbleUpdate = 1;
+        }
+        report[1] = 0x00;
+    }
+
+#ifndef MASTER
+    //Attach to the OG Xbox when the master has a controller for this player, and detach
+    //when it hasn't.
+    static bool attached = false;
+    if (linkEnabled != attached)
+    {
+        attached = linkEnabled;
+        if (attached)
+            halXidAttach();
+        else
+            halXidDetach();
+    }
+
+    if (attached)
+    {
+        static uint8_t reportSeq = 0;
+        uint8_t seq;
+        uint16_t rxTime;
+        do
+        {
+            seq = linkSeq;
+            rxTime = linkRxTime;
+            memcpy(&XboxOGDuke[0], &linkState[seq & 1], 20);
+        } while (seq != linkSeq);
+
+        //Load a new frame into the IN endpoint as soon as it is here, instead of waiting up
+        //to 4ms for the next report poll. If the host has not read the last report yet this
+        //is tried again next time round.
+        if (seq != reportSeq && halXidSendReport())
+        {
+            reportSeq = seq;
+#ifdef ENABLE_TELEMETRY
+            logLinkLatency((uint16_t)halMicros() - rxTime);
+#endif
+        }
+    }
+    sendControllerHIDReport();
+
+    //The LED is on while this player is attached and enumerated. A ping from the master
+    //flashes it for 250ms to confirm the slave is there.
+    static uint32_t pingTimer = 0;
+    static bool pinging = false;
+    static bool ledOn = false;
+    if (linkPinged)
+    {
+        linkPinged = false;
+        pinging = true;
+        pingTimer = halMillis();
+    }
+    if (pinging && halMillis() - pingTimer >= 250)
+        pinging = false;
+    bool led = pinging || (attached && enumerationComplete);
+    if (led != ledOn)
+    {
+        ledOn = led;
+        halPinWrite(ARDUINO_LED_PIN, led ? HAL_LOW : HAL_HIGH);
+    }
+
+    //The master does not poll for rumble, push the actuator values to it as soon as the
+    //OG Xbox changes them. They are sent again until the master echoes them back.
+    if (linkEnabled)
+    {
+        bool force = rumblePushNeeded;
+        rumblePushNeeded = false;
+        linkPushRumble(playerID, XboxOGDuke[0].left_actuator, XboxOGDuke[0].right_actuator, force);
+    }
+#endif
+}
+
+/* Send the HID report to the OG Xbox */
+void sendControllerHIDReport()
+{
+#if defined(ENABLE_TELEMETRY) && defined(MASTER)
+    if (halXidReport(ConnectedXID) && ConnectedXID == DUKE_CONTROLLER)
+        logFirstReport();
+#else
+    halXidReport(ConnectedXID);
+#endif
+    halXidTask();
+}
+
+//Wait until ms milliseconds have passed since start, while servicing the device side USB
+//stack so enumeration by the OG Xbox is not held up during boot.
+void bootWait(uint32_t start, uint16_t ms)
+{
+    while ((uint32_t)halMillis() - start < ms)
+    {
+        halXidTask();
+    }
+}
+
+#if defined(ENABLE_TELEMETRY) && !defined(MASTER)
+//Print the time from a state frame arriving from the master to its report being in the IN
+//endpoint, last and worst, once a second. Together with the TWI completion time printed by
+//the master this is the latency players 2-4 have on top of player 1.
+void logLinkLatency(uint16_t latency)
+{
+    static uint16_t maxLatency = 0;
+    static uint32_t logTimer = 0;
+    if (latency > maxLatency)
+        maxLatency = latency;
+    if (halMillis() - logTimer < 1000)
+        return;
+
+    logTimer = halMillis();
+    LinkStats_t *stats = linkGetStats();
+    halLog(PSTR("\r\nFrame to endpoint "));
+    halLogNum(latency);
+    halLog(PSTR("us, max "));
+    halLogNum(maxLatency);
+    halLog(PSTR("us, dropped "));
+    halLogNum(stats->dropped);
+    halLog(PSTR(", errors "));
+    halLogNum(stats->errors);
+}
+#endif
+
+#if defined(ENABLE_TELEMETRY) && defined(MASTER)
+//Print the time from power on to the first Duke report that carried a connected controller's input.
+//Called when a report has gone in the IN endpoint.
+void logFirstReport()
+{
+    static bool logged = false;
+    if (logged || !halPadConnected(0))
+        return;
+
+    logged = true;
+    halLog(PSTR("\r\nFirst report after "));
+    halLogNum(halMillis());
+    halLog(PSTR("ms"));
+}
+
+//telemetryTimer callback, once a second.
+void logTelemetry(uint8_t arg)
+{
+    logTransferOverruns();
+    logLinkStats();
+    logRam();
+}
+
+//Print the SRAM left between the heap and the stack, only when the high water mark moved.
+void logRam()
+{
+    static uint16_t lastFreeMin = 0xFFFF;
+    RamStats_t ram;
+    ramGetStats(&ram);
+    if (ram.freeMin == lastFreeMin)
+        return;
+
+    lastFreeMin = ram.freeMin;
+    halLog(PSTR("\r\nRAM static: "));
+    halLogNum(ram.staticBytes);
+    halLog(PSTR(" heap: "));
+    halLogNum(ram.heapBytes);
+    halLog(PSTR(" free: "));
+    halLogNum(ram.freeNow);
+    halLog(PSTR(" min free: "));
+    halLogNum(ram.freeMin);
+}
+
+//Print the number of USB transfers that were cut short because they ran out of time,
+//only when it went up.
+void logTransferOverruns()
+{
+    static uint16_t lastOverruns = 0;
+    HalHostStats_t host;
+    halHostGetStats(&host);
+    if (host.xferOverruns == lastOverruns)
+        return;
+
+    lastOverruns = host.xferOverruns;
+    halLog(PSTR("\r\nUSB transfer overruns: "));
+    halLogNum(lastOverruns);
+}
+
+//Print the I2C link throughput to each slave and the TWI queue stats.
+//Link 0 is the delta frames sent to all the slaves.
+void logLinkStats()
+{
+    static uint32_t lastBytes[MAX_CONTROLLERS];
+    for (uint8_t i = LINK_BROADCAST; i < MAX_CONTROLLERS; i++)
+    {
+        LinkStats_t *stats = linkGetStats(i);
+        halLog(PSTR("\r\nLink "));
+        halLogNum(i);
+        halLog(PSTR(": "));
+        halLogNum(stats->bytes - lastBytes[i]);
+        halLog(PSTR(" B/s, frames "));
+        halLogNum(stats->frames);
+        halLog(PSTR(", keyframes "));
+        halLogNum(stats->keyframes);
+        halLog(PSTR(", errors "));
+        halLogNum(stats->errors);
+        halLog(PSTR(", rumbles "));
+        halLogNum(stats->rumbles);
+        lastBytes[i] = stats->bytes;
+    }
+    TwiStats_t *twi = twiGetStats();
+    halLog(PSTR("\r\nTWI queue max "));
+    halLogNum(twi->maxDepth);
+    halLog(PSTR(", overflows "));
+    halLogNum(twi->overflows);
+    halLog(PSTR(", done in "));
+    halLogNum(twi->lastTime);
+    halLog(PSTR("us, max "));
+    halLogNum(twi->maxTime);
+    halLog(PSTR("us"));
+}
+
+//Print how long it took the USB stack to recover from a fault, and at which level.
+void logRecoveries()
+{
+    static uint16_t lastRecoveries = 0;
+    HalHostStats_t host;
+    halHostGetStats(&host);
+    if (host.recoveries == lastRecoveries)
+        return;
+
+    lastRecoveries = host.recoveries;
+    halLog(PSTR("\r\nUSB recovered in "));
+    halLogNum(host.lastRecoverTime);
+    halLog(PSTR("ms at level "));
+    halLogNum(host.lastRecoverLevel);
+}
+#endif
+
 #ifdef MASTER
-        /*** MASTER TASKS ***/
-        UsbHost.busprobe();
+//Map the input from one host side controller to its XID report, handle its
+//rumble/LED commands and forward it to the slave device if required.
+void serviceController(uint8_t i)
+{
+#ifdef ENABLE_TELEMETRY
+    //Report the time from a wired controller being plugged in to its first report.
+    static bool wasConnected[MAX_CONTROLLERS];
+    bool connected = halPadConnected(i);
+    if (connected && !wasConnected[i] && !halPadWireless(i))
+    {
+        HalHostStats_t host;
+        halHostGetStats(&host);
+        halLog(PSTR("\r\nController "));
+        halLogNum(i);
+        halLog(PSTR(" first report after "));
+        halLogNum((uint32_t)halMillis() - host.attachTime);
+        halLog(PSTR("ms, enumeration "));
+        halLogNum(host.lastEnumTime);
+        halLog(host.lastEnumCached ? PSTR("ms (cached)") : PSTR("ms"));
+    }
+    wasConnected[i] = connected;
+#endif
 
-        for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
+    if (halPadConnected(i))
+    {
+        //Button Mapping for Duke Controller
+        if (ConnectedXID == DUKE_CONTROLLER || i != 0)
         {
-            UsbHost.Task();
-            if (controllerConnected(i))
-            {
-                //Button Mapping for Duke Controller
-                if (ConnectedXID == DUKE_CONTROLLER || i != 0)
-                {
 
-                    //Read Digital Buttons
-                    XboxOGDuke[i].dButtons=0x0000;
-                    if (getButtonPress(UP, i))      XboxOGDuke[i].dButtons |= DUP;
-                    if (getButtonPress(DOWN, i))    XboxOGDuke[i].dButtons |= DDOWN;
-                    if (getButtonPress(LEFT, i))    XboxOGDuke[i].dButtons |= DLEFT;
-                    if (getButtonPress(RIGHT, i))   XboxOGDuke[i].dButtons |= DRIGHT;;
-                    if (getButtonPress(START, i))   XboxOGDuke[i].dButtons |= START_BTN;
-                    if (getButtonPress(BACK, i))    XboxOGDuke[i].dButtons |= BACK_BTN;
-                    if (getButtonPress(L3, i))      XboxOGDuke[i].dButtons |= LS_BTN;
-                    if (getButtonPress(R3, i))      XboxOGDuke[i].dButtons |= RS_BTN;
-
-                    //Read Analog Buttons - have to be converted to digital because x360 controllers don't have analog buttons
-                    getButtonPress(A, i)    ? XboxOGDuke[i].A = 0xFF      : XboxOGDuke[i].A = 0x00;
-                    getButtonPress(B, i)    ? XboxOGDuke[i].B = 0xFF      : XboxOGDuke[i].B = 0x00;
-                    getButtonPress(X, i)    ? XboxOGDuke[i].X = 0xFF      : XboxOGDuke[i].X = 0x00;
-                    getButtonPress(Y, i)    ? XboxOGDuke[i].Y = 0xFF      : XboxOGDuke[i].Y = 0x00;
-                    getButtonPress(L1, i)   ? XboxOGDuke[i].WHITE = 0xFF  : XboxOGDuke[i].WHITE = 0x00;
-                    getButtonPress(R1, i)   ? XboxOGDuke[i].BLACK = 0xFF  : XboxOGDuke[i].BLACK = 0x00;
-
-                    //Read Analog triggers
-                    XboxOGDuke[i].L = getButtonPress(L2, i); //0x00 to 0xFF
-                    XboxOGDuke[i].R = getButtonPress(R2, i); //0x00 to 0xFF
-
-                    //Read Control Sticks (16bit signed short)
-                    XboxOGDuke[i].leftStickX = getAnalogHat(LeftHatX, i);
-                    XboxOGDuke[i].leftStickY = getAnalogHat(LeftHatY, i);
-                    XboxOGDuke[i].rightStickX = getAnalogHat(RightHatX, i);
-                    XboxOGDuke[i].rightStickY = getAnalogHat(RightHatY, i);
-                }
+            //Read Digital Buttons
+            XboxOGDuke[i].dButtons=0x0000;
+            if (halPadButton(UP, i))      XboxOGDuke[i].dButtons |= DUP;
+            if (halPadButton(DOWN, i))    XboxOGDuke[i].dButtons |= DDOWN;
+            if (halPadButton(LEFT, i))    XboxOGDuke[i].dButtons |= DLEFT;
+            if (halPadButton(RIGHT, i))   XboxOGDuke[i].dButtons |= DRIGHT;;
+            if (halPadButton(START, i))   XboxOGDuke[i].dButtons |= START_BTN;
+            if (halPadButton(BACK, i))    XboxOGDuke[i].dButtons |= BACK_BTN;
+            if (halPadButton(L3, i))      XboxOGDuke[i].dButtons |= LS_BTN;
+            if (halPadButton(R3, i))      XboxOGDuke[i].dButtons |= RS_BTN;
+
+            //Read Analog Buttons - have to be converted to digital because x360 controllers don't have analog buttons
+            halPadButton(A, i)    ? XboxOGDuke[i].A = 0xFF      : XboxOGDuke[i].A = 0x00;
+            halPadButton(B, i)    ? XboxOGDuke[i].B = 0xFF      : XboxOGDuke[i].B = 0x00;
+            halPadButton(X, i)    ? XboxOGDuke[i].X = 0xFF      : XboxOGDuke[i].X = 0x00;
+            halPadButton(Y, i)    ? XboxOGDuke[i].Y = 0xFF      : XboxOGDuke[i].Y = 0x00;
+            halPadButton(L1, i)   ? XboxOGDuke[i].WHITE = 0xFF  : XboxOGDuke[i].WHITE = 0x00;
+            halPadButton(R1, i)   ? XboxOGDuke[i].BLACK = 0xFF  : XboxOGDuke[i].BLACK = 0x00;
+
+            //Read Analog triggers
+            XboxOGDuke[i].L = halPadButton(L2, i); //0x00 to 0xFF
+            XboxOGDuke[i].R = halPadButton(R2, i); //0x00 to 0xFF
+
+            //Read Control Sticks (16bit signed short) and apply the player's deadzone and curve
+            int16_t lx = halPadHat(LeftHatX, i), ly = halPadHat(LeftHatY, i);
+            int16_t rx = halPadHat(RightHatX, i), ry = halPadHat(RightHatY, i);
+            stickApply(i, &lx, &ly);
+            stickApply(i, &rx, &ry);
+            XboxOGDuke[i].leftStickX = lx;
+            XboxOGDuke[i].leftStickY = ly;
+            XboxOGDuke[i].rightStickX = rx;
+            XboxOGDuke[i].rightStickY = ry;
+        }
 #ifdef SUPPORTBATTALION
-                //Button Mapping for Steel Battalion Controller - only applicable for player 1 and Xbox 360 Wireless Controllers
-                else if (ConnectedXID == STEELBATTALION && Xbox360Wireless.Xbox360Connected[i] && i == 0)
+        //Button Mapping for Steel Battalion Controller - only applicable for player 1 and Xbox 360 Wireless Controllers
+        else if (ConnectedXID == STEELBATTALION && halPadWireless(i) && i == 0)
+        {
+            //R,N,1,2,3,4,5
+            static const uint8_t gearStates[7] = {7, 8, 9, 10, 11, 12, 13}; 
+            static int8_t currentGear = 1;                                  
+
+            XboxOGSteelBattalion.dButtons[0] = 0x0000;
+            XboxOGSteelBattalion.dButtons[1] = 0x0000;
+            XboxOGSteelBattalion.dButtons[2] &= 0xFFFC; //Need to only clear the two LSBs. The other bits are the toggle switches
+
+            //The buttons that are a bit per input, see sbmap.cpp for the mapping.
+            //Note the W0,W1 or W2 in the SBC_GAMEPAD button defines the offset in dButtons[X].
+            //i.e. SBC_GAMEPAD_W1_COMM3 should use dButtons[1].
+            sbMapApply(i, XboxOGSteelBattalion.dButtons);
+
+            if (halPadButton(L3, i))
+            {
+                if (!timerActive(&L3HoldTimer) && (virtualMouseY != 32768 || virtualMouseX != 32768))
                 {
-                    //R,N,1,2,3,4,5
-                    static const uint8_t gearStates[7] = {7, 8, 9, 10, 11, 12, 13}; 
-                    static int8_t currentGear = 1;                                  
-                    static int32_t virtualMouseX = 32768, virtualMouseY = 32768;
-
-                    XboxOGSteelBattalion.dButtons[0] = 0x0000;
-                    XboxOGSteelBattalion.dButtons[1] = 0x0000;
-                    XboxOGSteelBattalion.dButtons[2] &= 0xFFFC; //Need to only clear the two LSBs. The other bits are the toggle switches
-
-                    //L1/R1 = L and R bumpers
-                    //L2/R2 = L and R Triggers
-                    //L3/R3 - L and R Stick Press
-                    //Note the W0,W1 or W2 in the SBC_GAMEPAD button defines the offset in dButtons[X].
-                    //i.e. SBC_GAMEPAD_W1_COMM3 should use dButtons[1].
-                    if (Xbox360Wireless.getButtonPress(START, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_START;
-                    if (Xbox360Wireless.getButtonPress(L1, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_RIGHTJOYFIRE;
-                    static uint32_t L3HoldTimer = 0; //Timer for holding the Left stick in
-                    if (Xbox360Wireless.getButtonPress(L3, i))
-                    {
-                        XboxOGSteelBattalion.dButtons[2] |= SBC_GAMEPAD_W2_LEFTJOYSIGHTCHANGE;
-                        if (L3HoldTimer == 0 && (virtualMouseY != 32768 || virtualMouseX != 32768))
-                        {
-                            L3HoldTimer = millis();
-                        }
-                        else if ((millis() - L3HoldTimer) > 500)
-                        {
-                            virtualMouseX = 32768;
-                            virtualMouseY = 32768;
-                            L3HoldTimer = 0;
-                        }
-                    }
-                    else
-                    {
-                        L3HoldTimer = 0;
-                    }
-
-                    if (Xbox360Wireless.getButtonPress(R3, i) || Xbox360Wireless.getButtonPress(B, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_RIGHTJOYLOCKON;
-
-                    if (Xbox360Wireless.getButtonPress(R1, i) || Xbox360Wireless.getButtonPress(A, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_RIGHTJOYMAINWEAPON;
-
-                    if (Xbox360Wireless.getButtonPress(XBOX, i) || Xbox360Wireless.getChatPadPress(CHATPAD_0, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_EJECT;
-
-                    //What the X button does depends on what is needed by your VT.
-                    //It will Extinguish, Reload (if empty), or Wash if required. It will rumble for Chaff but you need to press Y to chaff.
-                    //This is determined by reading back the LED feedback from the console. The game normally
-                    //makes these LEDs flash when action is required. I use this data to rumble the controller and determine what X should do.
-                    if ((XboxOGSteelBattalionFeedback.Chaff_Extinguisher & 0xF0) != 0)
-                    {
-                        XboxOGDuke[i].right_actuator = (XboxOGSteelBattalionFeedback.Chaff_Extinguisher << 0) & 0xF0; //Only use right motor for chaff
-                        XboxOGDuke[i].rumbleUpdate = 1;
-                    }
-                    if ((XboxOGSteelBattalionFeedback.Chaff_Extinguisher & 0x0F) != 0)
-                    {
-                        XboxOGDuke[i].left_actuator = (XboxOGSteelBattalionFeedback.Chaff_Extinguisher << 4) & 0xF0;
-                        XboxOGDuke[i].right_actuator = XboxOGDuke[i].left_actuator;
-                        XboxOGDuke[i].rumbleUpdate = 1;
-                        if (Xbox360Wireless.getButtonPress(X, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_EXTINGUISHER;
-                    }
-                    if ((XboxOGSteelBattalionFeedback.Comm1_MagazineChange & 0x0F) != 0)
-                    {
-                        XboxOGDuke[i].left_actuator = (XboxOGSteelBattalionFeedback.Comm1_MagazineChange << 4) & 0xF0;
-                        XboxOGDuke[i].right_actuator = XboxOGDuke[i].left_actuator;
-                        XboxOGDuke[i].rumbleUpdate = 1;
-                        if (Xbox360Wireless.getButtonPress(X, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WEAPONCONMAGAZINE;
-                    }
-                    if ((XboxOGSteelBattalionFeedback.Washing_LineColorChange & 0xF0) != 0)
-                    {
-                        if (Xbox360Wireless.getButtonPress(X, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WASHING;
-                    }
-                    if ((XboxOGSteelBattalionFeedback.CockpitHatch_EmergencyEject & 0x0F) != 0)
-                    {
-                        XboxOGDuke[i].left_actuator = (XboxOGSteelBattalionFeedback.CockpitHatch_EmergencyEject << 4) & 0xF0;
-                        XboxOGDuke[i].right_actuator = XboxOGDuke[i].left_actuator;
-                        XboxOGDuke[i].rumbleUpdate = 1;
-                    }
-
-                    //Hold the messenger button for COMMS and Adjust TunerDial
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_MESSENGER, i) || Xbox360Wireless.getButtonPress(BACK, i))
-                    {
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_1, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_COMM1;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_2, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_COMM2;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_3, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_COMM3;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_4, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_COMM4;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_5, i))
-                            XboxOGSteelBattalion.dButtons[2] |= SBC_GAMEPAD_W2_COMM5;
-
-                        //Change tuner dial position by Holding the messenger then pressing D-pad directions.
-                        //Tuner dial = 0-15, corresponding to the 9o'clock position going clockwise.
-                        if (Xbox360Wireless.getButtonClick(UP, i) || Xbox360Wireless.getButtonClick(RIGHT, i))
-                            XboxOGSteelBattalion.tunerDial += 2;
-
-                        if (Xbox360Wireless.getButtonClick(DOWN, i) || Xbox360Wireless.getButtonClick(LEFT, i))
-                            XboxOGSteelBattalion.tunerDial -= 2;
-
-                        if (XboxOGSteelBattalion.tunerDial > 15)
-                            XboxOGSteelBattalion.tunerDial = 15;
-                        if (XboxOGSteelBattalion.tunerDial < 0)
-                            XboxOGSteelBattalion.tunerDial = 0;
-
-                        //The default configuration
-                    }
-                    else if (!Xbox360Wireless.getChatPadPress(CHATPAD_ORANGE, i))
-                    {
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_1, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_FUNCTIONF1;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_2, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_FUNCTIONTANKDETACH;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_3, i))
-                            XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_FUNCTIONFSS;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_4, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_FUNCTIONF2;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_5, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_FUNCTIONOVERRIDE;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_6, i))
-                            XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_FUNCTIONMANIPULATOR;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_7, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_FUNCTIONF3;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_8, i))
-                            XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_FUNCTIONNIGHTSCOPE;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_9, i))
-                            XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_FUNCTIONLINECOLORCHANGE;
-
-                        //Change gears by Pressing DUP or DDOWN. Limits are 0-6. //R,N,1,2,3,4,5
-                        //To prevent accidentally changing gears whilst rotating, I check to make sure you aren't pressing LEFT or RIGHT.
-                        if (Xbox360Wireless.getButtonClick(UP, i) && !(Xbox360Wireless.getButtonPress(LEFT, i) || Xbox360Wireless.getButtonPress(RIGHT, i)))
-                        {
-                            currentGear++;
-                        }
-                        else if (Xbox360Wireless.getButtonClick(DOWN, i) && !(Xbox360Wireless.getButtonPress(LEFT, i) || Xbox360Wireless.getButtonPress(RIGHT, i)))
-                        {
-                            currentGear--;
-                        }
-                        if (currentGear > 6)
-                            currentGear = 6;
-                        if (currentGear < 0)
-                            currentGear = 0;
-                        XboxOGSteelBattalion.gearLever = gearStates[currentGear];
-                    }
-
-                    if (Xbox360Wireless.getChatPadClick(CHATPAD_Q, i))
-                        XboxOGSteelBattalion.dButtons[2] ^= SBC_GAMEPAD_W2_TOGGLEOXYGENSUPPLY; //Toggle Switch
-                    if (Xbox360Wireless.getChatPadClick(CHATPAD_A, i))
-                        XboxOGSteelBattalion.dButtons[2] ^= SBC_GAMEPAD_W2_TOGGLEFILTERCONTROL; //Toggle Switch
-                    if (Xbox360Wireless.getChatPadClick(CHATPAD_W, i))
-                        XboxOGSteelBattalion.dButtons[2] ^= SBC_GAMEPAD_W2_TOGGLEVTLOCATION; //Toggle Switch
-                    if (Xbox360Wireless.getChatPadClick(CHATPAD_S, i))
-                        XboxOGSteelBattalion.dButtons[2] ^= SBC_GAMEPAD_W2_TOGGLEBUFFREMATERIAL; //Toggle Switch
-                    if (Xbox360Wireless.getChatPadClick(CHATPAD_Z, i))
-                        XboxOGSteelBattalion.dButtons[2] ^= SBC_GAMEPAD_W2_TOGGLEFUELFLOWRATE; //Toggle Switch
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_D, i))
-                        XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WASHING;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_F, i))
-                        XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_EXTINGUISHER;
-                    if (Xbox360Wireless.getChatPadClick(CHATPAD_SHIFT, i))
-                    {
-                        if (XboxOGSteelBattalion.dButtons[2] &= 0xFFFC)
-                        { //If any of the toggle switches are on SHIFT will turn everything off.
-                            XboxOGSteelBattalion.dButtons[2] &= ~0xFFFC;
-                        }
-                        else
-                        {
-                            XboxOGSteelBattalion.dButtons[2] |= 0xFFFC; //If all toggle switches are OFF, this will quickly turn them all on
-                        }
-                    }
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_G, i) || Xbox360Wireless.getButtonPress(Y, i))
-                        XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_CHAFF;
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_X, i) || Xbox360Wireless.getChatPadPress(CHATPAD_RIGHT, i))
-                        XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WEAPONCONMAIN;
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_C, i) || Xbox360Wireless.getChatPadPress(CHATPAD_LEFT, i))
-                        XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WEAPONCONSUB;
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_V, i) || Xbox360Wireless.getChatPadPress(CHATPAD_SPACE, i))
-                        XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WEAPONCONMAGAZINE;
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_U, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_MULTIMONOPENCLOSE;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_J, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_MULTIMONMODESELECT;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_N, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_MAINMONZOOMIN;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_I, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_MULTIMONMAPZOOMINOUT;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_K, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_MULTIMONSUBMONITOR;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_M, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_MAINMONZOOMOUT;
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_ENTER, i))
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_START;
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_P, i))
-                    {
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_COCKPITHATCH;
-                        XboxOGSteelBattalion.dButtons[0] &= ~SBC_GAMEPAD_W0_IGNITION; //Cannot have these two buttons pressed at the same time, some bioses will trigger an IGR
-                    }
-
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_COMMA, i))
-                    {
-                        XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_IGNITION;
-                        XboxOGSteelBattalion.dButtons[0] &= ~SBC_GAMEPAD_W0_COCKPITHATCH; //Cannot have these two buttons pressed at the same time, some bioses will trigger an IGR
-                    }
-
-                    /* Read Steel Battalion OUT endpoint for LED feedback from HOST to Device, this is not a standard HID Set Report, so is read here manually */
-                    uint8_t ep = Endpoint_GetCurrentEndpoint();
-                    Endpoint_SelectEndpoint(0x01); //0x01 is the out endpoint address for the SB Controller
-                    if (Endpoint_IsOUTReceived())
-                    {
-                        Endpoint_Read_Stream_LE(&XboxOGSteelBattalionFeedback, 22, NULL);
-                        Endpoint_ClearOUT();
-                    }
-                    Endpoint_SelectEndpoint(ep); //set back to the old endpoint.
-
-                    //Apply Pedals
-                    XboxOGSteelBattalion.leftPedal = (uint16_t)(Xbox360Wireless.getButtonPress(L2, i) << 8);  //0x00 to 0xFF00 SIDESTEP PEDAL
-                    XboxOGSteelBattalion.rightPedal = (uint16_t)(Xbox360Wireless.getButtonPress(R2, i) << 8); //0x00 to 0xFF00 ACCEL PEDAL
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_BACK, i))
-                    {
-                        XboxOGSteelBattalion.middlePedal = 0xFF00; //Brake Pedal
-                    }
-                    else
-                    {
-                        XboxOGSteelBattalion.middlePedal = 0x0000; //Brake Pedal
-                    }
-
-                    if (!Xbox360Wireless.getChatPadPress(CHATPAD_MESSENGER, i) && !Xbox360Wireless.getButtonPress(BACK, i))
-                    {
-                        if (Xbox360Wireless.getButtonPress(LEFT, i))
-                        {
-                            XboxOGSteelBattalion.rotationLever = -32767;
-                        }
-                        else if (Xbox360Wireless.getButtonPress(RIGHT, i))
-                        {
-                            XboxOGSteelBattalion.rotationLever = +32767;
-                        }
-                        else
-                        {
-                            XboxOGSteelBattalion.rotationLever = 0;
-                        }
-                    }
-
-                    //Apply analog sticks
-                    static int32_t sensitivity = 400;
-                    EEPROM.get(0x00, sensitivity);
-                    if (Xbox360Wireless.getChatPadPress(CHATPAD_ORANGE, i))
-                    {
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_9, i))
-                            sensitivity = 200;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_8, i))
-                            sensitivity = 250;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_7, i))
-                            sensitivity = 300;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_6, i))
-                            sensitivity = 350;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_5, i))
-                            sensitivity = 400;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_4, i))
-                            sensitivity = 650;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_3, i))
-                            sensitivity = 800;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_2, i))
-                            sensitivity = 1000;
-                        if (Xbox360Wireless.getChatPadPress(CHATPAD_1, i))
-                            sensitivity = 1200;
-                        int32_t temp = 0;
-                        EEPROM.get(0x00, temp);
-                        if (temp != sensitivity)
-                        {
-                            EEPROM.put(0x00, sensitivity);
-                            digitalWrite(ARDUINO_LED_PIN, !digitalRead(ARDUINO_LED_PIN));
-                            delay(100);
-                        }
-                    }
-
-                    XboxOGSteelBattalion.sightChangeX = Xbox360Wireless.getAnalogHat(LeftHatX, i);
-                    XboxOGSteelBattalion.sightChangeY = -Xbox360Wireless.getAnalogHat(LeftHatY, i) - 1;
-
-                    if (!Xbox360Wireless.getChatPadPress(CHATPAD_MESSENGER, i) && !Xbox360Wireless.getButtonPress(BACK, i))
-                    {
-                        //Moving aiming stick like a mouse cursor
-
-                        int32_t axisVal = Xbox360Wireless.getAnalogHat(RightHatX, i);
-                        if (axisVal > 7500 || axisVal < -7500)
-                        {
-                            virtualMouseX += axisVal / sensitivity;
-                        }
-
-                        axisVal = Xbox360Wireless.getAnalogHat(RightHatY, i);
-                        if (axisVal > 7500 || axisVal < -7500)
-                        {
-                            virtualMouseY -= axisVal / sensitivity;
-                        }
-
-                        if (virtualMouseX < 0)
-                            virtualMouseX = 0;
-                        if (virtualMouseX > 65535)
-                            virtualMouseX = 65535;
-                        if (virtualMouseY > 65535)
-                            virtualMouseY = 65535;
-                        if (virtualMouseY < 0)
-                            virtualMouseY = 0;
-
-                        XboxOGSteelBattalion.aimingX = (uint16_t)virtualMouseX;
-                        XboxOGSteelBattalion.aimingY = (uint16_t)virtualMouseY;
-                    }
-
-                    XboxOGSteelBattalion.sightChangeX = Xbox360Wireless.getAnalogHat(LeftHatX, i);
-                    XboxOGSteelBattalion.sightChangeY = -Xbox360Wireless.getAnalogHat(LeftHatY, i) - 1;
+                    timerStart(&L3HoldTimer, 500, 0, centreVirtualMouse, 0);
                 }
+            }
+            else
+            {
+                timerStop(&L3HoldTimer);
+            }
+
+            //What the X button does depends on what is needed by your VT.
+            //It will Extinguish, Reload (if empty), or Wash if required. It will rumble for Chaff but you need to press Y to chaff.
+            //This is determined by reading back the LED feedback from the console. The game normally
+            //makes these LEDs flash when action is required. The rumble is worked out from the same data
+            //when it arrives, see sbfeedback.h.
+            if (halPadButton(X, i))
+            {
+                if ((XboxOGSteelBattalionFeedback.Chaff_Extinguisher & 0x0F) != 0)
+                    XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_EXTINGUISHER;
+                if ((XboxOGSteelBattalionFeedback.Comm1_MagazineChange & 0x0F) != 0)
+                    XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WEAPONCONMAGAZINE;
+                if ((XboxOGSteelBattalionFeedback.Washing_LineColorChange & 0xF0) != 0)
+                    XboxOGSteelBattalion.dButtons[1] |= SBC_GAMEPAD_W1_WASHING;
+            }
+
+            //Hold the messenger button to Adjust TunerDial
+            if (halPadChatPad(CHATPAD_MESSENGER, i) || halPadButton(BACK, i))
+            {
+                //Change tuner dial position by Holding the messenger then pressing D-pad directions.
+                //Tuner dial = 0-15, corresponding to the 9o'clock position going clockwise.
+                if (halPadButtonClick(UP, i) || halPadButtonClick(RIGHT, i))
+                    XboxOGSteelBattalion.tunerDial += 2;
 
-                //Press the GREEN & ORANGE button on the chatpad to toggle between Duke and the Steel Battalion.
-                if (Xbox360Wireless.getChatPadPress(CHATPAD_GREEN, 0) && Xbox360Wireless.getChatPadClick(CHATPAD_ORANGE, 0))
+                if (halPadButtonClick(DOWN, i) || halPadButtonClick(LEFT, i))
+                    XboxOGSteelBattalion.tunerDial -= 2;
+
+                if (XboxOGSteelBattalion.tunerDial > 15)
+                    XboxOGSteelBattalion.tunerDial = 15;
+                if (XboxOGSteelBattalion.tunerDial < 0)
+                    XboxOGSteelBattalion.tunerDial = 0;
+
+                //The default configuration
+            }
+            else if (!halPadChatPad(CHATPAD_ORANGE, i))
+            {
+                //Change gears by Pressing DUP or DDOWN. Limits are 0-6. //R,N,1,2,3,4,5
+                //To prevent accidentally changing gears whilst rotating, I check to make sure you aren't pressing LEFT or RIGHT.
+                if (halPadButtonClick(UP, i) && !(halPadButton(LEFT, i) || halPadButton(RIGHT, i)))
                 {
-                    USB_Detach();
-                    disconnectTimer = millis();
-                    if (ConnectedXID != STEELBATTALION)
-                    {
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_OFF, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_ON, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_OFF, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_ON, i);
-                    }
-                    else
-                    {
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_ON, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_OFF, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_ON, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_OFF, i);
-                    }
+                    currentGear++;
                 }
-                if (disconnectTimer != 0 && millis() - disconnectTimer > 500)
+                else if (halPadButtonClick(DOWN, i) && !(halPadButton(LEFT, i) || halPadButton(RIGHT, i)))
                 {
-                    if (ConnectedXID != STEELBATTALION)
-                    {
-                        ConnectedXID = STEELBATTALION;
-                        XboxOGDuke[0].left_actuator = 0;
-                        XboxOGDuke[0].right_actuator = 0;
-                        XboxOGDuke[0].rumbleUpdate = 1;
-                        XboxOGSteelBattalion.dButtons[0] = 0x0000;
-                        XboxOGSteelBattalion.dButtons[1] = 0x0000;
-                        XboxOGSteelBattalion.dButtons[2] = 0x0000;
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_OFF, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_ON, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_OFF, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_ON, i);
-                    }
-                    else
-                    {
-                        ConnectedXID = DUKE_CONTROLLER;
-                        XboxOGDuke[0].left_actuator = 0;
-                        XboxOGDuke[0].right_actuator = 0;
-                        XboxOGDuke[0].rumbleUpdate = 1;
-                        XboxOGDuke[0].dButtons = 0x0000;
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_ON, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_OFF, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_GREEN_ON, i);
-                        Xbox360Wireless.chatPadQueueLed(CHATPAD_LED_ORANGE_OFF, i);
-                    }
-                    disconnectTimer = 0;
+                    currentGear--;
                 }
-#endif
+                if (currentGear > 6)
+                    currentGear = 6;
+                if (currentGear < 0)
+                    currentGear = 0;
+                XboxOGSteelBattalion.gearLever = gearStates[currentGear];
+            }
 
-                //Anything that sends a command to the Xbox 360 controllers happens here.
-                //(i.e rumble, LED changes, controller off command)
-                static uint32_t commandTimer[MAX_CONTROLLERS] = {0};
-                static uint32_t xboxHoldTimer[MAX_CONTROLLERS] = {0};
-                if (millis() - commandTimer[i] > 16)
-                {
-                    //If you hold the XBOX button for more than ~1second, turn off controller
-                    if (getButtonPress(XBOX, i))
-                    {
-                        if (xboxHoldTimer[i] == 0)
-                        {
-                            xboxHoldTimer[i] = millis();
-                        }
-                        if ((millis() - xboxHoldTimer[i]) > 1000 && (millis() - xboxHoldTimer[i]) < 1100)
-                        {
-                            XboxOGDuke[i].dButtons = 0x00;
-                            setRumbleOn(0, 0, i);
-                            delay(10);
-                            Xbox360Wireless.disconnect(i);
-                            xboxHoldTimer[i] = 0;
-                        }
-                    }
-                    //START+BACK TRIGGERS is a standard soft reset command.
-                    //We turn off the rumble motors here to prevent them getting locked on
-                    //if you happen to press this reset combo mid rumble.
-                    else if (getButtonPress(START, i) && getButtonPress(BACK, i) &&
-                             getButtonPress(L2, i) > 0x00 && getButtonPress(R2, i) > 0x00)
-                    {
-                        //Turn off rumble on all controllers
-                        for (uint8_t j = 0; j < MAX_CONTROLLERS; j++)
-                        {
-                            XboxOGDuke[j].left_actuator = 0;
-                            XboxOGDuke[j].right_actuator = 0;
-                            XboxOGDuke[j].rumbleUpdate = 1;
-                        }
-                    }
-                    //If Xbox button isnt held down, send the rumble commands
-                    else
-                    {
-                        xboxHoldTimer[i] = 0; //Reset the XBOX button hold time counter.
-                        if (XboxOGDuke[i].rumbleUpdate == 1)
-                        {
-                            setRumbleOn(XboxOGDuke[i].left_actuator, XboxOGDuke[i].right_actuator, i);
-                            XboxOGDuke[i].rumbleUpdate = 0;
-                        }
-                    }
-                    commandTimer[i] = millis();
+            if (halPadChatPadClick(CHATPAD_SHIFT, i))
+            {
+                if (XboxOGSteelBattalion.dButtons[2] &= 0xFFFC)
+                { //If any of the toggle switches are on SHIFT will turn everything off.
+                    XboxOGSteelBattalion.dButtons[2] &= ~0xFFFC;
                 }
-
-                //Send controller state to slave devices, and retrieve actuator/rumble values from slave devices.
-                //Applicable to player 2, 3 and 4 only. i.e when i>0.
-                static uint32_t rumblei2cTimer[MAX_CONTROLLERS] = {0}; //Timer to monitor how often rumbles are requested.
-                if (i > 0)
+                else
                 {
-                    Wire.beginTransmission(i);
-                    Wire.write((char *)&XboxOGDuke[i], 20);
-                    Wire.endTransmission(true);
-                    if (millis() - rumblei2cTimer[i] > 8)
-                    {
-                        if (Wire.requestFrom(i, (uint8_t)2) == 2)
-                        {
-                            int temp = Wire.read(); //read first 8 bytes - this is left actuator, returns -1 on error.
-                            if (temp != -1 && XboxOGDuke[i].left_actuator != (uint8_t)temp)
-                            {
-                                XboxOGDuke[i].left_actuator = (uint8_t)temp;
-                                XboxOGDuke[i].rumbleUpdate = 1;
-                            }
-
-                            temp = Wire.read(); //read second 8 bytes - this is right actuator, returns -1 on error.
-                            if (temp != -1 && XboxOGDuke[i].right_actuator != (uint8_t)temp)
-                            {
-                                XboxOGDuke[i].right_actuator = (uint8_t)temp;
-                                XboxOGDuke[i].rumbleUpdate = 1;
-                            }
-                        }
-                        else
-                        {
-                            //just clear the buffer, must've been an error.
-                            Wire.flush();
-                        }
-                        rumblei2cTimer[i] = millis();
-                    }
+                    XboxOGSteelBattalion.dButtons[2] |= 0xFFFC; //If all toggle switches are OFF, this will quickly turn them all on
                 }
+            }
+
+            if (halPadChatPad(CHATPAD_P, i))
+            {
+                XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_COCKPITHATCH;
+                XboxOGSteelBattalion.dButtons[0] &= ~SBC_GAMEPAD_W0_IGNITION; //Cannot have these two buttons pressed at the same time, some bioses will trigger an IGR
+            }
+
+            if (halPadChatPad(CHATPAD_COMMA, i))
+            {
+                XboxOGSteelBattalion.dButtons[0] |= SBC_GAMEPAD_W0_IGNITION;
+                XboxOGSteelBattalion.dButtons[0] &= ~SBC_GAMEPAD_W0_COCKPITHATCH; //Cannot have these two buttons pressed at the same time, some bioses will trigger an IGR
+            }
+
+            /* Read Steel Battalion OUT endpoint for LED feedback from HOST to Device, this is not a standard HID Set Report, so is read here manually */
+            //0x01 is the out endpoint address for the SB Controller
+            if (halXidReadOut(0x01, &XboxOGSteelBattalionFeedback, 22))
+                sbFeedbackReceived();
 
-                /*Check/send the Player 1 HID report every loop to minimise lag even more on the master*/
-                sendControllerHIDReport();
+            //Apply Pedals
+            XboxOGSteelBattalion.leftPedal = (uint16_t)(halPadButton(L2, i) << 8);  //0x00 to 0xFF00 SIDESTEP PEDAL
+            XboxOGSteelBattalion.rightPedal = (uint16_t)(halPadButton(R2, i) << 8); //0x00 to 0xFF00 ACCEL PEDAL
+            if (halPadChatPad(CHATPAD_BACK, i))
+            {
+                XboxOGSteelBattalion.middlePedal = 0xFF00; //Brake Pedal
             }
             else
             {
-                //If the respective controller isn't synced, we instead send a disablePacket over the i2c bus
-                //so that the slave device knows to disable its USB. I've arbitrarily made this 0xF0.
-                if (i > 0)
+                XboxOGSteelBattalion.middlePedal = 0x0000; //Brake Pedal
+            }
+
+            if (!halPadChatPad(CHATPAD_MESSENGER, i) && !halPadButton(BACK, i))
+            {
+                if (halPadButton(LEFT, i))
+                {
+                    XboxOGSteelBattalion.rotationLever = -32767;
+                }
+                else if (halPadButton(RIGHT, i))
                 {
-                    static uint8_t disablePacket[1] = {0xF0};
-                    Wire.beginTransmission(i);
-                    Wire.write((char *)disablePacket, 1);
-                    Wire.endTransmission(true);
+                    XboxOGSteelBattalion.rotationLever = +32767;
+                }
+                else
+                {
+                    XboxOGSteelBattalion.rotationLever = 0;
                 }
             }
-        } //End master for loop
 
-        //Handle Player 1 controller connect/disconnect events.
-        if (controllerConnected(0) && disconnectTimer == 0)
-        {
-            USB_Attach();
-            if (enumerationComplete)
+            //Apply analog sticks
+            uint16_t sensitivity = config.sbSensitivity;
+            if (halPadChatPad(CHATPAD_ORANGE, i))
             {
-                digitalWrite(ARDUINO_LED_PIN, LOW);
+                if (halPadChatPad(CHATPAD_9, i))
+                    sensitivity = 200;
+                if (halPadChatPad(CHATPAD_8, i))
+                    sensitivity = 250;
+                if (halPadChatPad(CHATPAD_7, i))
+                    sensitivity = 300;
+                if (halPadChatPad(CHATPAD_6, i))
+                    sensitivity = 350;
+                if (halPadChatPad(CHATPAD_5, i))
+                    sensitivity = 400;
+                if (halPadChatPad(CHATPAD_4, i))
+                    sensitivity = 650;
+                if (halPadChatPad(CHATPAD_3, i))
+                    sensitivity = 800;
+                if (halPadChatPad(CHATPAD_2, i))
+                    sensitivity = 1000;
+                if (halPadChatPad(CHATPAD_1, i))
+                    sensitivity = 1200;
+                if (config.sbSensitivity != sensitivity)
+                {
+                    config.sbSensitivity = sensitivity;
+                    configSave();
+                    stickSetAimSensitivity(sensitivity);
+                    halPinWrite(ARDUINO_LED_PIN, !halPinRead(ARDUINO_LED_PIN));
+                }
             }
+
+            XboxOGSteelBattalion.sightChangeX = halPadHat(LeftHatX, i);
+            XboxOGSteelBattalion.sightChangeY = -halPadHat(LeftHatY, i) - 1;
+
+            uint8_t elapsed = virtualMouseElapsed();
+            if (!halPadChatPad(CHATPAD_MESSENGER, i) && !halPadButton(BACK, i))
+            {
+                //Moving aiming stick like a mouse cursor, by how long it was held since the last pass
+                int32_t stepX = stickAimStep(halPadHat(RightHatX, i));
+                int32_t stepY = -stickAimStep(halPadHat(RightHatY, i));
+                virtualMouseX = moveVirtualMouse(virtualMouseX, &virtualMouseFracX, stepX, elapsed);
+                virtualMouseY = moveVirtualMouse(virtualMouseY, &virtualMouseFracY, stepY, elapsed);
+
+                XboxOGSteelBattalion.aimingX = (uint16_t)virtualMouseX;
+                XboxOGSteelBattalion.aimingY = (uint16_t)virtualMouseY;
+            }
+
+            XboxOGSteelBattalion.sightChangeX = halPadHat(LeftHatX, i);
+            XboxOGSteelBattalion.sightChangeY = -halPadHat(LeftHatY, i) - 1;
         }
-        else if (millis() > 7000)
-        {
-            digitalWrite(ARDUINO_LED_PIN, HIGH);
-            USB_Detach(); //Disconnect from the OG Xbox port.
-            Xbox360Wireless.chatPadInitNeeded[0] = 1;
-        }
-        else
+
+        //Press the GREEN & ORANGE button on the chatpad to toggle between Duke and the Steel Battalion.
+        if (halPadChatPad(CHATPAD_GREEN, 0) && halPadChatPadClick(CHATPAD_ORANGE, 0))
         {
-            USB_Attach();
-            sendControllerHIDReport();
+            halXidDetach();
+            timerStart(&disconnectTimer, 500, 0, swapXID, i);
+            if (ConnectedXID != STEELBATTALION)
+            {
+                halPadChatPadLed(CHATPAD_LED_GREEN_OFF, i);
+                halPadChatPadLed(CHATPAD_LED_ORANGE_ON, i);
+                halPadChatPadLed(CHATPAD_LED_GREEN_OFF, i);
+                halPadChatPadLed(CHATPAD_LED_ORANGE_ON, i);
+            }
+            else
+            {
+                halPadChatPadLed(CHATPAD_LED_GREEN_ON, i);
+                halPadChatPadLed(CHATPAD_LED_ORANGE_OFF, i);
+                halPadChatPadLed(CHATPAD_LED_GREEN_ON, i);
+                halPadChatPadLed(CHATPAD_LED_ORANGE_OFF, i);
+            }
         }
-
-/***END MASTER TASKS ***/
 #endif
 
-        //THPS 2X is the only game I know that sends rumble commands to the USB OUT pipe
-        //instead of the control pipe. So unfortunately need to manually read the out pipe
-        //and update rumble values as needed!
-        uint8_t ep = Endpoint_GetCurrentEndpoint();
-        static uint8_t report[6];
-        Endpoint_SelectEndpoint(0x02); //0x02 is the out endpoint address for the Duke Controller
-        if (Endpoint_IsOUTReceived())
+        //Anything that sends a command to the Xbox 360 controllers happens here.
+        //(i.e rumble, LED changes, controller off command)
+        if ((commandDue & (1 << i)) && !insideUsbTask)
         {
-            Endpoint_Read_Stream_LE(report, 6, NULL);
-            Endpoint_ClearOUT();
-            if (report[1] == 0x06)
+            commandDue &= ~(1 << i);
+            //If you hold the XBOX button for more than ~1second, turn off controller
+            if (halPadButton(XBOX, i))
             {
-                XboxOGDuke[0].left_actuator = report[3];
-                XboxOGDuke[0].right_actuator = report[5];
-                XboxOGDuke[0].rumbleUpdate = 1;
+                if (!timerActive(&xboxHoldTimer[i]))
+                {
+                    timerStart(&xboxHoldTimer[i], 1000, 0, powerOffController, i);
+                }
+            }
+            //START+BACK TRIGGERS is a standard soft reset command.
+            //We turn off the rumble motors here to prevent them getting locked on
+            //if you happen to press this reset combo mid rumble.
+            else if (halPadButton(START, i) && halPadButton(BACK, i) &&
+                     halPadButton(L2, i) > 0x00 && halPadButton(R2, i) > 0x00)
+            {
+                //Turn off rumble on all controllers
+                for (uint8_t j = 0; j < MAX_CONTROLLERS; j++)
+                {
+                    XboxOGDuke[j].left_actuator = 0;
+                    XboxOGDuke[j].right_actuator = 0;
+                    XboxOGDuke[j].rumbleUpdate = 1;
+                }
+            }
+            //If Xbox button isnt held down, send the rumble commands
+            else
+            {
+                timerStop(&xboxHoldTimer[i]); //Reset the XBOX button hold time counter.
+                //Rumble that doesn't go through is sent again the next time commands are due
+                if (XboxOGDuke[i].rumbleUpdate == 1 &&
+                    halPadRumble(XboxOGDuke[i].left_actuator, XboxOGDuke[i].right_actuator, i))
+                {
+                    XboxOGDuke[i].rumbleUpdate = 0;
+                }
             }
-            report[1] = 0x00;
         }
-        Endpoint_SelectEndpoint(ep); //set back to the old endpoint.
 
-#ifndef MASTER
-        if (inputBuffer[0] != 0xF0)
+        //Send controller state to slave devices. Applicable to player 2, 3 and 4 only. i.e when i>0.
+        //The changes for all the slaves go out together in linkFlush() after every controller was serviced.
+        //The slaves push their actuator/rumble values to us, see rumbleReceived().
+        if (i > 0)
         {
-            memcpy(&XboxOGDuke[0], inputBuffer, 20);
+            linkSendState(i, &XboxOGDuke[i]);
         }
+
+        /*Check/send the Player 1 HID report every loop to minimise lag even more on the master*/
         sendControllerHIDReport();
-#endif
     }
-}
-
-/* Send the HID report to the OG Xbox */
-void sendControllerHIDReport()
-{
-    switch (ConnectedXID)
+    else
     {
-    case DUKE_CONTROLLER:
-        if (USB_Device_GetFrameNumber() - DukeController_HID_Interface.State.PrevFrameNum >= 4)
-        {
-            HID_Device_USBTask(&DukeController_HID_Interface); //Send OG Xbox HID Report
-        }
-        break;
-#ifdef SUPPORTBATTALION
-    case STEELBATTALION:
-        if (USB_Device_GetFrameNumber() - SteelBattalion_HID_Interface.State.PrevFrameNum >= 4)
+        //If the respective controller isn't synced, we instead flag its slot as disabled in the next
+        //delta frame so that the slave device knows to disable its USB.
+        if (i > 0)
         {
-            HID_Device_USBTask(&SteelBattalion_HID_Interface); //Send OG Xbox HID Report
+            linkSendDisable(i);
         }
-        break;
-#endif
     }
-    USB_USBTask();
 }
 
-#ifdef MASTER
-//Parse button presses for each type of controller
-uint8_t getButtonPress(ButtonEnum b, uint8_t controller)
+//Called from twiTask() when a slave has written new actuator values to the master.
+void rumbleReceived(uint8_t addr, uint8_t status, const uint8_t *data, uint8_t len)
 {
-    if (Xbox360Wireless.Xbox360Connected[controller])
-        return Xbox360Wireless.getButtonPress(b, controller);
-
-#ifdef SUPPORTWIREDXBOX360
-    if (Xbox360Wired[controller]->Xbox360Connected)
-        return Xbox360Wired[controller]->getButtonPress(b);
-#endif
+    uint8_t left, right;
+    uint8_t slave = linkReceiveRumble(data, len, &left, &right);
+    if (slave == 0)
+        return;
 
-#ifdef SUPPORTWIREDXBOXONE
-    if (XboxOneWired[controller]->XboxOneConnected)
+    if (XboxOGDuke[slave].left_actuator != left || XboxOGDuke[slave].right_actuator != right)
     {
-        if (b == L2 || b == R2)
-        {
-            //Xbone one triggers are 10-bit, remove 2LSBs so its 8bit like OG Xbox
-            return (uint8_t)(XboxOneWired[controller]->getButtonPress(b) >> 2); 
-        }
-        else
-        {
-            return (uint8_t)XboxOneWired[controller]->getButtonPress(b);
-        }
+        XboxOGDuke[slave].left_actuator = left;
+        XboxOGDuke[slave].right_actuator = right;
+        XboxOGDuke[slave].rumbleUpdate = 1;
     }
-#endif
-
-    return 0;
 }
 
-//Parse analog stick requests for each type of controller.
-int16_t getAnalogHat(AnalogHatEnum a, uint8_t controller)
+//commandTimer callback. Lets controller arg take its next rumble/LED command.
+void commandTick(uint8_t arg)
 {
-    if (Xbox360Wireless.Xbox360Connected[controller])
-        return Xbox360Wireless.getAnalogHat(a, controller);
-
-#ifdef SUPPORTWIREDXBOX360
-    if (Xbox360Wired[controller]->Xbox360Connected)
-    {
-        int16_t val;
-        val = Xbox360Wired[controller]->getAnalogHat(a);
-        if (val == -32512) //8bitdo range fix
-            val = -32768;
-        return val;
-    }
-
-#endif
-
-#ifdef SUPPORTWIREDXBOXONE
-    if (XboxOneWired[controller]->XboxOneConnected)
-        return XboxOneWired[controller]->getAnalogHat(a);
-#endif
-
-    return 0;
+    commandDue |= 1 << arg;
 }
 
-//Parse rumble activation requests for each type of controller.
-void setRumbleOn(uint8_t lValue, uint8_t rValue, uint8_t controller)
+//xboxHoldTimer callback. The XBOX button was held for a second, turn the controller off.
+void powerOffController(uint8_t controller)
 {
-    if (Xbox360Wireless.Xbox360Connected[controller])
-        Xbox360Wireless.setRumbleOn(lValue, rValue, controller);
+    XboxOGDuke[controller].dButtons = 0x00;
+    halPadRumble(0, 0, controller);
+    halDelay(10);
+    halPadPowerOff(controller);
+}
 
-#ifdef SUPPORTWIREDXBOX360
-    if (Xbox360Wired[controller]->Xbox360Connected)
+#ifdef SUPPORTBATTALION
+//disconnectTimer callback. The OG Xbox has seen the detach, come back as the other XID device.
+void swapXID(uint8_t controller)
+{
+    sbFeedbackReset();
+    if (ConnectedXID != STEELBATTALION)
     {
-        Xbox360Wired[controller]->setRumbleOn(lValue, rValue); 
+        ConnectedXID = STEELBATTALION;
+        XboxOGDuke[0].left_actuator = 0;
+        XboxOGDuke[0].right_actuator = 0;
+        XboxOGDuke[0].rumbleUpdate = 1;
+        XboxOGSteelBattalion.dButtons[0] = 0x0000;
+        XboxOGSteelBattalion.dButtons[1] = 0x0000;
+        XboxOGSteelBattalion.dButtons[2] = 0x0000;
+        halPadChatPadLed(CHATPAD_LED_GREEN_OFF, controller);
+        halPadChatPadLed(CHATPAD_LED_ORANGE_ON, controller);
+        halPadChatPadLed(CHATPAD_LED_GREEN_OFF, controller);
+        halPadChatPadLed(CHATPAD_LED_ORANGE_ON, controller);
     }
-#endif
-
-#ifdef SUPPORTWIREDXBOXONE
-    if (XboxOneWired[controller]->XboxOneConnected)
+    else
     {
-        XboxOneWired[controller]->setRumbleOn(lValue / 8, rValue / 8, lValue / 2, rValue / 2);
+        ConnectedXID = DUKE_CONTROLLER;
+        XboxOGDuke[0].left_actuator = 0;
+        XboxOGDuke[0].right_actuator = 0;
+        XboxOGDuke[0].rumbleUpdate = 1;
+        XboxOGDuke[0].dButtons = 0x0000;
+        halPadChatPadLed(CHATPAD_LED_GREEN_ON, controller);
+        halPadChatPadLed(CHATPAD_LED_ORANGE_OFF, controller);
+        halPadChatPadLed(CHATPAD_LED_GREEN_ON, controller);
+        halPadChatPadLed(CHATPAD_LED_ORANGE_OFF, controller);
     }
-#endif
 }
 
-//Parse LED activation requests for each type of controller.
-void setLedOn(LEDEnum led, uint8_t controller)
+//L3HoldTimer callback
+void centreVirtualMouse(uint8_t arg)
+{
+    virtualMouseX = 32768;
+    virtualMouseY = 32768;
+    virtualMouseFracX = 0;
+    virtualMouseFracY = 0;
+}
+
+//Milliseconds since the last call, so the aiming speed doesn't depend on how fast the main loop runs.
+//Capped at SB_AIM_MAX_ELAPSED so a stall, or coming back from Duke mode, doesn't make the cursor jump.
+uint8_t virtualMouseElapsed()
 {
-    if (Xbox360Wireless.Xbox360Connected[controller])
-        Xbox360Wireless.setLedOn(led, controller);
+    uint16_t now = timerNow();
+    uint16_t elapsed = now - virtualMouseTick;
+    virtualMouseTick = now;
+    return elapsed > SB_AIM_MAX_ELAPSED ? SB_AIM_MAX_ELAPSED : elapsed;
+}
 
-#ifdef SUPPORTWIREDXBOX360
-    if (Xbox360Wired[controller]->Xbox360Connected)
-        Xbox360Wired[controller]->setLedOn(led);
+//Moves one axis of the aiming cursor step 256ths of a count per SB_AIM_PERIOD for elapsed ms.
+//What is left over of a count is kept in frac and added on next time, so slow aiming isn't lost
+//and the speed is the same both ways, only where the whole counts fall differs.
+int32_t moveVirtualMouse(int32_t pos, uint16_t *frac, int32_t step, uint8_t elapsed)
+{
+    int32_t moved = *frac + step * elapsed; //In SB_AIM_FRACs of a count
+    *frac = moved & (SB_AIM_FRAC - 1);
+    pos += (moved - *frac) / SB_AIM_FRAC; //Exact, frac stays positive
+
+    if (pos < 0)
+        pos = 0;
+    if (pos > 65535)
+        pos = 65535;
+    return pos;
+}
 #endif
 
-#ifdef SUPPORTWIREDXBOXONE
-    if (XboxOneWired[controller]->XboxOneConnected)
+//Called by the USB host stack while it is waiting on a device that is still enumerating.
+//This keeps controllers that are already connected reporting to the OG Xbox and the slave
+//devices, rather than freezing them until the new device has finished being set up.
+//Only the XID reports and the I2C link are serviced here. Rumble/LED commands and the timer
+//callbacks, which can send commands or block, wait until halHostTask() has returned.
+void serviceControllersDuringEnumeration()
+{
+    insideUsbTask = true;
+    for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
     {
-        //no LEDs on Xbox One Controller. I think it is possible to adjust brightness but this is not implemented.
+        serviceController(i);
     }
-#endif
+    insideUsbTask = false;
+    linkFlush();
+    twiTask();
 }
 
-bool controllerConnected(uint8_t controller)
+//Pulse the reset line of the USB host controller. The USB stack reinitialises it afterwards.
+void resetHostController()
 {
-    if (Xbox360Wireless.Xbox360Connected[controller])
-        return 1;
-
-#ifdef SUPPORTWIREDXBOX360
-    if (Xbox360Wired[controller]->Xbox360Connected)
-        return 1;
-#endif
-
-#ifdef SUPPORTWIREDXBOXONE
-    if (XboxOneWired[controller]->XboxOneConnected)
-        return 1;
-#endif
-    return 0;
+    halPinWrite(USB_HOST_RESET_PIN, HAL_LOW);
+    bootWait(halMillis(), 20);
+    halPinWrite(USB_HOST_RESET_PIN, HAL_HIGH);
 }
 #endif
@@ -0,0 +1,199 @@
+/*
+ * harness.cpp
+ *
+ * Runs the master loop on a PC against hal_native.cpp, in virtual time. Goes through power on,
+ * a wireless and a wired controller, rumble from the OG Xbox and from a slave, a device that
+ * takes a while to enumerate, the Steel Battalion and unplugging, checks what comes out of the
+ * XID device and the I2C link, then times the loop with four controllers connected.
+ *
+ * Exits with 1 if a check failed. Build and run it with the native env in platformio.ini.
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include "hal.h"
+#include "i2clink.h"
+#include "twimaster.h"
+#include "swtimer.h"
+
+#define PASS_US 500 //Virtual time each pass of the loop is given on top of what the HAL calls cost
+#define BENCH_PASSES 100000
+
+static int failures;
+static uint64_t passes;
+static uint64_t hostNs;
+
+static uint16_t stallCalls;
+
+static void stallCallback(uint8_t arg)
+{
+    stallCalls++;
+}
+
+static void check(bool ok, const char *what)
+{
+    printf("%s %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+//Run the loop for ms of virtual time.
+static void run(uint32_t ms)
+{
+    uint32_t end = halMillis() + ms;
+    auto start = std::chrono::steady_clock::now();
+    while ((int32_t)(halMillis() - end) < 0)
+    {
+        firmwareTask();
+        halNativeAdvance(PASS_US);
+        passes++;
+    }
+    hostNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const USB_XboxGamepad_Data_t *dukeReport()
+{
+    return (const USB_XboxGamepad_Data_t *)halNative.data;
+}
+
+//The echo of the last rumble frame from slave in the last delta frame.
+static uint8_t deltaEcho(uint8_t slave)
+{
+    const uint8_t *frame = halNative.twiLast[LINK_BROADCAST];
+    uint16_t slot = frame[2 + (slave - 1) * 2] | frame[3 + (slave - 1) * 2] << 8;
+    return (slot & LINK_SLOT_ECHO) >> LINK_SLOT_ECHO_SHIFT;
+}
+
+int main()
+{
+    HalNativePad_t p1 = {}, p2 = {};
+    uint32_t reports;
+
+    firmwareBegin();
+
+    run(100);
+    check(halNative.attached && halNative.reports > 20, "attached with no controller in the boot window");
+
+    //A wireless controller for player 1
+    p1.connected = true;
+    p1.wireless = true;
+    p1.buttons = pgm_read_word(&XBOX_BUTTONS[A]);
+    p1.r2 = 0x80;
+    p1.hat[LeftHatX] = 20000;
+    halNativeSetPad(0, &p1);
+    run(50);
+    check(halNative.xid == DUKE_CONTROLLER && dukeReport()->A == 0xFF && dukeReport()->R == 0x80,
+          "player 1 buttons and trigger in the Duke report");
+    check(dukeReport()->leftStickX > 0 && dukeReport()->leftStickX != 20000, "player 1 stick shaped");
+
+    //THPS 2X style rumble on the OUT endpoint
+    const uint8_t rumbleOut[6] = {0x00, 0x06, 0x00, 0x40, 0x00, 0x80};
+    halNativeXidOut(0x02, rumbleOut, sizeof(rumbleOut));
+    run(50);
+    check(halNative.rumble[0][0] == 0x40 && halNative.rumble[0][1] == 0x80, "OUT endpoint rumble reaches player 1");
+
+    //A wired controller for player 2, its slave gets keyframes
+    p2.connected = true;
+    p2.buttons = pgm_read_word(&XBOX_BUTTONS[B]);
+    halNativeSetPad(1, &p2);
+    run(250);
+    const uint8_t *key = halNative.twiLast[1];
+    check(halNative.twiFrames[1] >= 2 && key[0] == LINK_HEADER(LINK_FRAME_KEY) &&
+              key[LINK_STATE_OFFSET + 3] == 0xFF,
+          "player 2 state in the keyframes to slave 1");
+    check(halNative.twiFrames[LINK_BROADCAST] > 0, "delta frames on the general call");
+
+    //Slave 1 pushes rumble, the master passes it on and echoes its sequence number
+    uint8_t rumbleFrame[LINK_RUMBLE_SIZE] = {LINK_HEADER(LINK_FRAME_RUMBLE), 5, 1, 0x20, 0x60, 0};
+    for (uint8_t i = 0; i < LINK_RUMBLE_SIZE - 1; i++)
+        rumbleFrame[LINK_RUMBLE_SIZE - 1] = halCrc8(rumbleFrame[LINK_RUMBLE_SIZE - 1], rumbleFrame[i]);
+    halNativeTwiReceive(rumbleFrame, sizeof(rumbleFrame));
+    p2.buttons = 0;
+    halNativeSetPad(1, &p2); //A change, so a delta frame goes out
+    run(50);
+    check(halNative.rumble[1][0] == 0x20 && halNative.rumble[1][1] == 0x60, "slave rumble reaches player 2");
+    check(deltaEcho(1) == 5, "rumble sequence echoed to slave 1");
+
+    //A device that takes 300ms to enumerate doesn't stop player 1's reports
+    reports = halNative.reports;
+    halNativeEnumerate(300);
+    run(1);
+    check(halNative.reports - reports >= 70, "reports go on while a device enumerates");
+
+#ifdef SUPPORTBATTALION
+    //GREEN held, ORANGE clicked swaps to the Steel Battalion
+    p1.buttons = 0;
+    p1.chatPad = (uint32_t)CHATPAD_GREEN << 16;
+    halNativeSetPad(0, &p1);
+    run(10);
+    p1.chatPad = (uint32_t)(CHATPAD_GREEN | CHATPAD_ORANGE) << 16;
+    halNativeSetPad(0, &p1);
+    run(600);
+    p1.chatPad = CHATPAD_F;
+    halNativeSetPad(0, &p1);
+    run(50);
+    const USB_XboxSteelBattalion_Data_t *sb = (const USB_XboxSteelBattalion_Data_t *)halNative.data;
+    check(halNative.xid == STEELBATTALION && (sb->dButtons[1] & SBC_GAMEPAD_W1_EXTINGUISHER),
+          "Steel Battalion with the chatpad mapping");
+#endif
+
+    //Player 1 unplugged after the boot window, the OG Xbox sees nothing
+    run(BOOT_ATTACH_WINDOW);
+    p1.connected = false;
+    halNativeSetPad(0, &p1);
+    run(50);
+    reports = halNative.reports;
+    run(100);
+    check(!halNative.attached && halNative.reports == reports, "detached once player 1 is gone");
+
+    printf("scenario: %llu passes in %lu ms virtual, %.0f ns per pass on this host\n",
+           (unsigned long long)passes, (unsigned long)halMillis(), (double)hostNs / passes);
+
+    //A 16ms timer and a 500ms stall of the loop, it fires once and stays on its 16ms grid
+    Timer_t stallTimer = {};
+    uint16_t stallStart = timerNow();
+    timerStart(&stallTimer, 16, 16, stallCallback, 0);
+    halNativeAdvance(500000);
+    timerTask();
+    uint16_t afterStall = stallCalls;
+    while (stallCalls == afterStall)
+    {
+        halNativeAdvance(1000);
+        timerTask();
+    }
+    timerStop(&stallTimer);
+    uint16_t next = timerNow() - stallStart;
+    printf("stall: %u calls for a 500ms stall of a 16ms timer, the next one %ums after it was started\n",
+           afterStall, next);
+    check(afterStall == 1 && next % 16 == 0, "a stall gives one call and keeps the phase");
+
+    //Four controllers, the A button and a stick changing every 64 passes, so reports and delta frames go out
+    HalNativePad_t pad = {};
+    pad.connected = true;
+    for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
+        halNativeSetPad(i, &pad);
+    passes = 0;
+    hostNs = 0;
+    uint32_t frames = halNative.twiFrames[LINK_BROADCAST];
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < BENCH_PASSES; n++)
+    {
+        if (n % 64 == 0)
+        {
+            pad.hat[LeftHatX] = (int16_t)(n * 7);
+            pad.buttons ^= pgm_read_word(&XBOX_BUTTONS[A]);
+            for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
+                halNativeSetPad(i, &pad);
+        }
+        firmwareTask();
+        halNativeAdvance(PASS_US);
+    }
+    hostNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    TwiStats_t *twi = twiGetStats();
+    printf("benchmark: %u passes, %.0f ns per pass on this host, %lu delta frames, TWI queue max %u, done in max %uus\n",
+           BENCH_PASSES, (double)hostNs / BENCH_PASSES, (unsigned long)(halNative.twiFrames[LINK_BROADCAST] - frames),
+           twi->maxDepth, twi->maxTime);
+
+    printf("%s, %d failed\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * ramwatch.c
+ *
+ * SRAM usage at run time. See ramwatch.h.
+ */
+
+#include <avr/io.h>
+#include "ramwatch.h"
+
+extern uint8_t __data_start; //Start of .data, the first byte of RAM the program uses
+extern uint8_t __heap_start; //End of .bss
+extern uint8_t __stack;      //Top of RAM
+extern char *__brkval __attribute__((weak)); //Top of the heap, NULL until malloc() is first used.
+                                             //Weak so asking for it doesn't link in malloc().
+
+void ramPaint(void) __attribute__((naked, used, section(".init1")));
+
+//Fill the RAM between .bss and the top of RAM with RAM_PAINT. This runs straight after reset
+//with no stack and no zero register yet, so it is all in assembly.
+void ramPaint(void)
+{
+    __asm__ volatile(
+        "    ldi r30, lo8(__heap_start)\n"
+        "    ldi r31, hi8(__heap_start)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :
+        : "M"(RAM_PAINT));
+}
+
+void ramGetStats(RamStats_t *stats)
+{
+    uint8_t *heapTop = (&__brkval != 0 && __brkval != 0) ? (uint8_t *)__brkval : &__heap_start;
+    uint8_t *p = heapTop;
+    uint8_t *sp = (uint8_t *)SP;
+
+    //The stack has never been deeper than the first byte that isn't paint
+    while (p < sp && *p == RAM_PAINT)
+        p++;
+
+    stats->staticBytes = &__heap_start - &__data_start;
+    stats->heapBytes = heapTop - &__heap_start;
+    stats->freeNow = sp - heapTop;
+    stats->freeMin = p - heapTop;
+}
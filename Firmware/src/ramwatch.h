@@ -0,0 +1,42 @@
+/*
+ * ramwatch.h
+ *
+ * SRAM usage at run time.
+ *
+ * At reset, before .data and .bss are set up, everything from the end of .bss to the top of
+ * RAM is filled with RAM_PAINT. The stack grows down into that area and the heap grows up into
+ * it, so the painted bytes that are left between them show how close they have ever come.
+ * A stack byte that happens to be written with RAM_PAINT counts as untouched, so freeMin can be
+ * a few bytes too optimistic.
+ *
+ * The stats can be read from a running device with a vendor request on the OG Xbox side USB
+ * port, bmRequestType 0xC0 and bRequest RAM_VENDOR_REQUEST, which returns RamStats_t.
+ */
+
+#ifndef RAMWATCH_H_
+#define RAMWATCH_H_
+#include <inttypes.h>
+
+#define RAM_PAINT 0xC5
+#define RAM_VENDOR_REQUEST 0xA0
+
+typedef struct
+{
+    uint16_t staticBytes; //.data and .bss
+    uint16_t heapBytes;   //Allocated by malloc() or new, 0 while the heap is unused
+    uint16_t freeNow;     //Between the top of the heap and the stack pointer
+    uint16_t freeMin;     //Least free there has ever been, the stack high water mark
+} RamStats_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void ramGetStats(RamStats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RAMWATCH_H_ */
@@ -0,0 +1,131 @@
+/*
+ * sbfeedback.cpp
+ *
+ * Steel Battalion LED feedback to rumble. See sbfeedback.h.
+ */
+
+#include "settings.h"
+#ifdef SUPPORTBATTALION
+#include <stddef.h>
+#include "hal.h"
+#include "swtimer.h"
+#include "sbfeedback.h"
+
+#define SBF_LEFT 0x01
+#define SBF_RIGHT 0x02
+#define SBF_HIGH 0x04 //The LED is the high nibble of its byte
+
+typedef struct
+{
+    uint8_t offset; //Byte of USB_XboxSteelBattalion_Feedback_t
+    uint8_t flags;  //SBF_ motors and nibble
+    uint8_t pulse;  //ms per step of brightness the motors run when the LED comes on, 0 while it is lit
+} SbFeedbackEvent_t;
+
+#define SBF_EVENT(field, flags, pulse) {offsetof(USB_XboxSteelBattalion_Feedback_t, field), flags, pulse}
+
+static const SbFeedbackEvent_t events[] PROGMEM = {
+    SBF_EVENT(Chaff_Extinguisher, SBF_RIGHT | SBF_HIGH, 0),         //Chaff, only the right motor
+    SBF_EVENT(Chaff_Extinguisher, SBF_LEFT | SBF_RIGHT, 16),         //Extinguisher
+    SBF_EVENT(Comm1_MagazineChange, SBF_LEFT | SBF_RIGHT, 16),       //Magazine change
+    SBF_EVENT(CockpitHatch_EmergencyEject, SBF_LEFT | SBF_RIGHT, 0), //Emergency eject
+};
+
+#define SBF_EVENTS (sizeof(events) / sizeof(events[0]))
+
+static uint8_t lit;                   //Bit per event whose LED is lit
+static uint8_t spent;                 //Bit per pulsing event whose pulse has ended while its LED is lit
+static uint16_t pulseEnd[SBF_EVENTS]; //timerNow() the pulse of an event ends on
+static Timer_t pulseTimer;
+
+static void pulseEnded(uint8_t arg);
+
+//Motor speeds from the LEDs that are lit, and a pulseTimer for the next pulse that ends.
+static void updateRumble()
+{
+    uint8_t left = 0, right = 0;
+    uint16_t now = timerNow();
+    uint16_t nextEnd = 0xFFFF;
+
+    for (uint8_t e = 0; e < SBF_EVENTS; e++)
+    {
+        uint8_t bit = 1 << e;
+        if (!(lit & bit) || (spent & bit))
+            continue;
+
+        SbFeedbackEvent_t event;
+        memcpy_P(&event, &events[e], sizeof(event));
+        if (event.pulse)
+        {
+            uint16_t remaining = pulseEnd[e] - now;
+            if ((int16_t)remaining <= 0)
+            {
+                spent |= bit;
+                continue;
+            }
+            if (remaining < nextEnd)
+                nextEnd = remaining;
+        }
+
+        uint8_t led = ((const uint8_t *)&XboxOGSteelBattalionFeedback)[event.offset];
+        uint8_t speed = (event.flags & SBF_HIGH) ? led & 0xF0 : led << 4;
+        if ((event.flags & SBF_LEFT) && speed > left)
+            left = speed;
+        if ((event.flags & SBF_RIGHT) && speed > right)
+            right = speed;
+    }
+
+    if (nextEnd != 0xFFFF)
+        timerStart(&pulseTimer, nextEnd, 0, pulseEnded, 0);
+    else
+        timerStop(&pulseTimer);
+
+    if (XboxOGDuke[0].left_actuator != left || XboxOGDuke[0].right_actuator != right)
+    {
+        XboxOGDuke[0].left_actuator = left;
+        XboxOGDuke[0].right_actuator = right;
+        XboxOGDuke[0].rumbleUpdate = 1;
+    }
+}
+
+//pulseTimer callback
+static void pulseEnded(uint8_t arg)
+{
+    updateRumble();
+}
+
+//Call when a new feedback report has been read into XboxOGSteelBattalionFeedback.
+void sbFeedbackReceived()
+{
+    uint16_t now = timerNow();
+    uint8_t wasLit = lit;
+    lit = 0;
+    for (uint8_t e = 0; e < SBF_EVENTS; e++)
+    {
+        SbFeedbackEvent_t event;
+        memcpy_P(&event, &events[e], sizeof(event));
+        uint8_t led = ((const uint8_t *)&XboxOGSteelBattalionFeedback)[event.offset];
+        led = (event.flags & SBF_HIGH) ? led >> 4 : led & 0x0F;
+        if (led == 0)
+            continue;
+
+        uint8_t bit = 1 << e;
+        lit |= bit;
+        if (!(wasLit & bit) && event.pulse)
+        {
+            pulseEnd[e] = now + led * event.pulse;
+            spent &= ~bit;
+        }
+    }
+    spent &= lit;
+    updateRumble();
+}
+
+//Forget the LEDs, e.g. when switching to or from the Steel Battalion. Doesn't touch the motors.
+void sbFeedbackReset()
+{
+    lit = 0;
+    spent = 0;
+    timerStop(&pulseTimer);
+}
+#endif
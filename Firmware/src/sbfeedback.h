@@ -0,0 +1,30 @@
+/*
+ * sbfeedback.h
+ *
+ * Rumble from the Steel Battalion cockpit LEDs.
+ *
+ * The game lights the LEDs of the cockpit buttons when an action is needed, e.g. the
+ * extinguisher when the VT is on fire. The brightness of an LED is a nibble of the 22 byte
+ * feedback report the OG Xbox writes to OUT endpoint 0x01. sbFeedbackReceived() is called only
+ * when a new report has arrived and works out the motor speeds of player 1 from it, the
+ * speed of an event is its LED brightness. An event that pulses rumbles for a time that
+ * grows with its brightness each time its LED comes on, the game flashing the LED makes a
+ * pattern of knocks rather than a constant buzz. Other events rumble for as long as their LED
+ * is lit.
+ *
+ * Only a change of motor speeds sets rumbleUpdate, so a report that changes nothing the
+ * rumble depends on sends nothing to the controller.
+ */
+
+#ifndef SBFEEDBACK_H_
+#define SBFEEDBACK_H_
+#include "settings.h"
+
+#ifdef SUPPORTBATTALION
+
+void sbFeedbackReceived();
+void sbFeedbackReset();
+
+#endif
+
+#endif /* SBFEEDBACK_H_ */
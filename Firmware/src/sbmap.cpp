@@ -0,0 +1,154 @@
+/*
+ * sbmap.cpp
+ *
+ * Steel Battalion button mapping. See sbmap.h.
+ */
+
+#include "settings.h"
+#ifdef SUPPORTBATTALION
+#include <string.h>
+#include "hal.h"
+#include "sbmap.h"
+
+#define PAD(b) (SBMAP_PAD | (b))
+
+static const SbMapEntry_t sbMap[] PROGMEM = {
+    //L1/R1 = L and R bumpers, L3/R3 - L and R Stick Press
+    {PAD(START), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_START)},
+    {PAD(L1), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_RIGHTJOYFIRE)},
+    {PAD(L3), SBMAP_ANY, SBMAP_OUT(2, SBC_GAMEPAD_W2_LEFTJOYSIGHTCHANGE)},
+    {PAD(R3), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_RIGHTJOYLOCKON)},
+    {PAD(B), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_RIGHTJOYLOCKON)},
+    {PAD(R1), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_RIGHTJOYMAINWEAPON)},
+    {PAD(A), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_RIGHTJOYMAINWEAPON)},
+    {PAD(XBOX), SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_EJECT)},
+    {CHATPAD_0, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_EJECT)},
+
+    //Hold the messenger button for COMMS
+    {CHATPAD_1, SBMAP_COMMS, SBMAP_OUT(1, SBC_GAMEPAD_W1_COMM1)},
+    {CHATPAD_2, SBMAP_COMMS, SBMAP_OUT(1, SBC_GAMEPAD_W1_COMM2)},
+    {CHATPAD_3, SBMAP_COMMS, SBMAP_OUT(1, SBC_GAMEPAD_W1_COMM3)},
+    {CHATPAD_4, SBMAP_COMMS, SBMAP_OUT(1, SBC_GAMEPAD_W1_COMM4)},
+    {CHATPAD_5, SBMAP_COMMS, SBMAP_OUT(2, SBC_GAMEPAD_W2_COMM5)},
+
+    //The function buttons otherwise. With ORANGE held the numbers set the aiming sensitivity.
+    {CHATPAD_1, SBMAP_FUNCTION, SBMAP_OUT(1, SBC_GAMEPAD_W1_FUNCTIONF1)},
+    {CHATPAD_2, SBMAP_FUNCTION, SBMAP_OUT(1, SBC_GAMEPAD_W1_FUNCTIONTANKDETACH)},
+    {CHATPAD_3, SBMAP_FUNCTION, SBMAP_OUT(0, SBC_GAMEPAD_W0_FUNCTIONFSS)},
+    {CHATPAD_4, SBMAP_FUNCTION, SBMAP_OUT(1, SBC_GAMEPAD_W1_FUNCTIONF2)},
+    {CHATPAD_5, SBMAP_FUNCTION, SBMAP_OUT(1, SBC_GAMEPAD_W1_FUNCTIONOVERRIDE)},
+    {CHATPAD_6, SBMAP_FUNCTION, SBMAP_OUT(0, SBC_GAMEPAD_W0_FUNCTIONMANIPULATOR)},
+    {CHATPAD_7, SBMAP_FUNCTION, SBMAP_OUT(1, SBC_GAMEPAD_W1_FUNCTIONF3)},
+    {CHATPAD_8, SBMAP_FUNCTION, SBMAP_OUT(1, SBC_GAMEPAD_W1_FUNCTIONNIGHTSCOPE)},
+    {CHATPAD_9, SBMAP_FUNCTION, SBMAP_OUT(0, SBC_GAMEPAD_W0_FUNCTIONLINECOLORCHANGE)},
+
+    //Toggle Switches
+    {CHATPAD_Q, SBMAP_ANY | SBMAP_TOGGLE, SBMAP_OUT(2, SBC_GAMEPAD_W2_TOGGLEOXYGENSUPPLY)},
+    {CHATPAD_A, SBMAP_ANY | SBMAP_TOGGLE, SBMAP_OUT(2, SBC_GAMEPAD_W2_TOGGLEFILTERCONTROL)},
+    {CHATPAD_W, SBMAP_ANY | SBMAP_TOGGLE, SBMAP_OUT(2, SBC_GAMEPAD_W2_TOGGLEVTLOCATION)},
+    {CHATPAD_S, SBMAP_ANY | SBMAP_TOGGLE, SBMAP_OUT(2, SBC_GAMEPAD_W2_TOGGLEBUFFREMATERIAL)},
+    {CHATPAD_Z, SBMAP_ANY | SBMAP_TOGGLE, SBMAP_OUT(2, SBC_GAMEPAD_W2_TOGGLEFUELFLOWRATE)},
+
+    {CHATPAD_D, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WASHING)},
+    {CHATPAD_F, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_EXTINGUISHER)},
+    {CHATPAD_G, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_CHAFF)},
+    {PAD(Y), SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_CHAFF)},
+    {CHATPAD_X, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WEAPONCONMAIN)},
+    {CHATPAD_RIGHT, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WEAPONCONMAIN)},
+    {CHATPAD_C, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WEAPONCONSUB)},
+    {CHATPAD_LEFT, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WEAPONCONSUB)},
+    {CHATPAD_V, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WEAPONCONMAGAZINE)},
+    {CHATPAD_SPACE, SBMAP_ANY, SBMAP_OUT(1, SBC_GAMEPAD_W1_WEAPONCONMAGAZINE)},
+
+    {CHATPAD_U, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_MULTIMONOPENCLOSE)},
+    {CHATPAD_J, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_MULTIMONMODESELECT)},
+    {CHATPAD_N, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_MAINMONZOOMIN)},
+    {CHATPAD_I, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_MULTIMONMAPZOOMINOUT)},
+    {CHATPAD_K, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_MULTIMONSUBMONITOR)},
+    {CHATPAD_M, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_MAINMONZOOMOUT)},
+    {CHATPAD_ENTER, SBMAP_ANY, SBMAP_OUT(0, SBC_GAMEPAD_W0_START)},
+};
+
+#define SBMAP_SIZE (sizeof(sbMap) / sizeof(sbMap[0]))
+
+static uint8_t replaced[(SBMAP_SIZE + 7) / 8]; //Bit per sbMap entry an override replaces
+
+void sbMapBegin()
+{
+    memset(replaced, 0, sizeof(replaced));
+    for (uint8_t i = 0; i < SBMAP_SIZE; i++)
+    {
+        SbMapEntry_t entry;
+        memcpy_P(&entry, &sbMap[i], sizeof(entry));
+        for (uint8_t j = 0; j < SBMAP_OVERRIDES; j++)
+        {
+            if (config.sbMap[j].input == entry.input && config.sbMap[j].flags == entry.flags)
+                replaced[i >> 3] |= 1 << (i & 7);
+        }
+    }
+}
+
+//Sets or toggles the output of one entry if its input is pressed. buttons is the pad button word,
+//held the chatpad modifiers in bits 16-23 and keys in bits 8-15 and 0-7.
+static inline void applyEntry(const SbMapEntry_t *entry, uint16_t buttons, uint32_t held,
+                              uint8_t controller, uint16_t *dButtons)
+{
+    uint8_t input = entry->input;
+    bool pressed;
+    if (entry->flags & SBMAP_TOGGLE)
+        pressed = !(input & SBMAP_PAD) && halPadChatPadClick((ChatPadButton)input, controller);
+    else if (input & SBMAP_PAD)
+        pressed = buttons & pgm_read_word(&XBOX_BUTTONS[input & ~SBMAP_PAD]);
+    else if (input < 17) //Modifiers are a bit each
+        pressed = (uint8_t)(held >> 16) & input;
+    else
+        pressed = (uint8_t)(held >> 8) == input || (uint8_t)held == input;
+
+    uint8_t out = entry->output;
+    if (!pressed || out == SBMAP_NONE)
+        return;
+    if (entry->flags & SBMAP_TOGGLE)
+        dButtons[out >> 4] ^= 1 << (out & 0x0F);
+    else
+        dButtons[out >> 4] |= 1 << (out & 0x0F);
+}
+
+void sbMapApply(uint8_t controller, uint16_t *dButtons)
+{
+    uint16_t buttons = halPadButtonWord(controller);
+    uint32_t held = halPadChatPadWord(controller);
+    bool clicked = halPadChatPadClicked(controller);
+    if (buttons == 0 && held == 0 && !clicked)
+        return;
+
+    //The layer that works with the modifiers that are held. With ORANGE only SBMAP_ANY entries work.
+    uint8_t layer;
+    if ((held & ((uint32_t)CHATPAD_MESSENGER << 16)) || (buttons & pgm_read_word(&XBOX_BUTTONS[BACK])))
+        layer = SBMAP_COMMS;
+    else if (held & ((uint32_t)CHATPAD_ORANGE << 16))
+        layer = SBMAP_LAYER;
+    else
+        layer = SBMAP_FUNCTION;
+
+    SbMapEntry_t entry;
+    for (uint8_t i = 0; i < SBMAP_SIZE; i++)
+    {
+        memcpy_P(&entry, &sbMap[i], sizeof(entry));
+        uint8_t entryLayer = entry.flags & SBMAP_LAYER;
+        if ((entryLayer != SBMAP_ANY && entryLayer != layer) || ((entry.flags & SBMAP_TOGGLE) && !clicked))
+            continue;
+        if (replaced[i >> 3] & (1 << (i & 7)))
+            continue;
+        applyEntry(&entry, buttons, held, controller, dButtons);
+    }
+
+    for (uint8_t i = 0; i < SBMAP_OVERRIDES; i++)
+    {
+        const SbMapEntry_t *extra = &config.sbMap[i];
+        uint8_t entryLayer = extra->flags & SBMAP_LAYER;
+        if (extra->input == 0 || (entryLayer != SBMAP_ANY && entryLayer != layer))
+            continue;
+        applyEntry(extra, buttons, held, controller, dButtons);
+    }
+}
+#endif
@@ -0,0 +1,48 @@
+/*
+ * sbmap.h
+ *
+ * Mapping of the Xbox 360 wireless controller and chatpad to the Steel Battalion buttons.
+ *
+ * The mapping is a table of SbMapEntry_t in flash. sbMapApply() reads the button and chatpad
+ * state of the wireless controller once and goes through the table in one pass, setting the
+ * dButtons bit of every entry whose input is held. Toggle switches flip their bit when the
+ * key is clicked instead.
+ *
+ * Entries only work in their layer. SBMAP_COMMS entries work while MESSENGER or BACK is held,
+ * SBMAP_FUNCTION entries while neither of them nor ORANGE is held, SBMAP_ANY entries always.
+ *
+ * The SBMAP_OVERRIDES entries in config.sbMap change the mapping without reflashing. An
+ * override with the same input and flags as a built in entry replaces it, SBMAP_NONE as its
+ * output unmaps the input. Other overrides add to the mapping. sbMapBegin() works out what is
+ * replaced, call it again after changing config.sbMap.
+ *
+ * The gears, tuner dial, X button, cockpit hatch and ignition are more than a bit per input
+ * and stay in main.cpp.
+ */
+
+#ifndef SBMAP_H_
+#define SBMAP_H_
+#include <inttypes.h>
+#include "settings.h"
+#include "config.h"
+
+#ifdef SUPPORTBATTALION
+
+#define SBMAP_PAD 0x80 //SbMapEntry_t input is a ButtonEnum of a digital pad button, not a chatpad key
+
+#define SBMAP_ANY 0x00
+#define SBMAP_COMMS 0x01
+#define SBMAP_FUNCTION 0x02
+#define SBMAP_LAYER 0x03
+#define SBMAP_TOGGLE 0x04 //Flip the bit on a click instead of holding it while pressed
+
+//Output of bit mask of dButtons[word]
+#define SBMAP_OUT(word, mask) (uint8_t)((word) << 4 | __builtin_ctz(mask))
+#define SBMAP_NONE 0xFF
+
+void sbMapBegin();
+void sbMapApply(uint8_t controller, uint16_t *dButtons);
+
+#endif
+
+#endif /* SBMAP_H_ */
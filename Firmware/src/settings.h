@@ -17,7 +17,8 @@
 //Settings - Note the Atmega 32U4 has only 32KB of flash!
 //The Arduino bootloader takes up about 15% of this.
 //if the Program Memory Usage is >85% or so it may fail
-//programming the device. You cannot enable all the below settings at once :(
+//programming the device. The MASTER_360WLESS_360W_ONEW_STEELBATTALION environment enables
+//all the below settings at once with extra size flags. The build fails if an image doesn't fit.
 
 //Define these or pass to Makefile
 //#define COMPILE_SLAVE
@@ -37,6 +38,12 @@
 #define SUPPORTBATTALION
 #endif
 
+/* The Steel Battalion aiming cursor moves by the aiming stick divided by the sensitivity
+   every SB_AIM_PERIOD ms, however fast the main loop runs. A power of two up to 256. */
+#define SB_AIM_PERIOD 4
+#define SB_AIM_MAX_ELAPSED 32
+#define SB_AIM_FRAC (256L * SB_AIM_PERIOD) //Fractions of a count the cursor position is kept in
+
 /* Define this to add support for Wired Xbox One Controllers. */
 #ifndef DISABLE_WIREDXBOXONE
 #define SUPPORTWIREDXBOXONE
@@ -48,9 +55,33 @@
 #define SUPPORTWIREDXBOX360
 #endif
 
+/* Number of USB host drivers, the hub and the wireless receiver plus a slot for the
+   wired controller of each player. Sizes the driver and address tables of the USB host stack. */
+#if defined(SUPPORTWIREDXBOXONE) || defined(SUPPORTWIREDXBOX360)
+#define WIRED_SLOTS 4
+#define USB_NUMDRIVERS (2 + WIRED_SLOTS)
+#else
+#define USB_NUMDRIVERS 2
+#endif
+
+/* How long in milliseconds after power on the ogx360 stays attached to the OG Xbox
+   with no controller connected, so games and the BIOS see a controller while
+   the controllers are still being connected. It detaches after this until a
+   controller is connected. */
+#define BOOT_ATTACH_WINDOW 7000
+
+/* Define this to print timing measurements to Serial1 at 500000 baud. */
+//#define ENABLE_TELEMETRY
+
+/* EEPROM address of the user settings, see config.h. Older firmware used 0x00-0x03 and
+   0x20, so the image starts after those and can't be mistaken for them. */
+#define CONFIG_EEPROM_ADDR 0x21
+
 #endif
 
 /* prototypes */
+void firmwareBegin();
+void firmwareTask();
 void sendControllerHIDReport();
 
 #endif /* MAIN_H_ */
@@ -0,0 +1,190 @@
+/*
+ * stick.cpp
+ *
+ * Analog stick shaping. See stick.h.
+ */
+
+#include "settings.h"
+#ifdef MASTER
+#include "hal.h"
+#include "config.h"
+#include "stick.h"
+
+#define STICK_MAX 32767L
+
+//Response curves, output for inputs of 0, 1/16 ... 16/16 of the travel outside the deadzone
+static const uint16_t curves[STICK_CURVES][STICK_TABLE_SIZE] PROGMEM = {
+    {0, 2048, 4096, 6144, 8192, 10240, 12288, 14336, 16384, 18431, 20479, 22527, 24575, 26623, 28671, 30719, 32767},
+    {0, 512, 1448, 2660, 4096, 5724, 7525, 9482, 11585, 13824, 16190, 18679, 21283, 23998, 26819, 29744, 32767},
+    {0, 128, 512, 1152, 2048, 3200, 4608, 6272, 8192, 10368, 12800, 15488, 18431, 21631, 25087, 28799, 32767},
+    {0, 8192, 11585, 14189, 16384, 18317, 20066, 21673, 23170, 24575, 25905, 27169, 28377, 29536, 30651, 31727, 32767},
+};
+
+//The Steel Battalion aiming stick keeps its old feel: nothing inside 7500, unchanged outside it.
+static const StickConfig_t aimConfig = {7500 / 128, 7500 / 128, STICK_CURVE_LINEAR, STICK_AXIAL};
+
+typedef struct
+{
+    uint16_t deadzone;
+    uint16_t step;                    //2^20 / (32767 - deadzone), deflection to 256ths of a table step
+    uint16_t gains[STICK_TABLE_SIZE]; //Output / input at each table deflection
+} StickTable_t;
+
+static StickTable_t tables[MAX_CONTROLLERS];
+static StickTable_t aimTable;
+static uint16_t aimScale; //65535 / Steel Battalion sensitivity
+
+//Curve output for t of 65536ths of the travel outside the deadzone, interpolated between entries.
+static int32_t curveAt(uint8_t curve, uint32_t t)
+{
+    uint8_t i = t >> 12;
+    if (i >= STICK_TABLE_SIZE - 1)
+        return pgm_read_word(&curves[curve][STICK_TABLE_SIZE - 1]);
+    int32_t a = pgm_read_word(&curves[curve][i]);
+    int32_t b = pgm_read_word(&curves[curve][i + 1]);
+    return a + (((b - a) * (int32_t)(t & 0x0FFF)) >> 12);
+}
+
+//Work out the gain at each table point. The points are spread evenly over the travel outside
+//the deadzone. Divisions are fine here, it only runs when the settings change.
+static void buildTable(const StickConfig_t *cfg, StickTable_t *table)
+{
+    int32_t deadzone = (int32_t)cfg->deadzone << 7;
+    int32_t anti = (int32_t)cfg->antiDeadzone << 7;
+    uint8_t curve = cfg->curve < STICK_CURVES ? cfg->curve : STICK_CURVE_LINEAR;
+
+    if (deadzone >= STICK_MAX)
+        deadzone = STICK_MAX - 1;
+    table->deadzone = deadzone;
+    table->step = (1UL << 20) / (STICK_MAX - deadzone);
+    for (uint8_t k = 0; k < STICK_TABLE_SIZE; k++)
+    {
+        uint32_t t = (uint32_t)k << 12; //65536ths of the travel outside the deadzone
+        int32_t in = deadzone + (((STICK_MAX - deadzone) * k) >> 4);
+        int32_t out = anti + curveAt(curve, t) * (STICK_MAX - anti) / STICK_MAX;
+        if (in == 0)
+        {
+            //No deadzone, use the gain a little way along the curve
+            in = STICK_MAX >> 8;
+            out = anti + curveAt(curve, 1UL << 8) * (STICK_MAX - anti) / STICK_MAX;
+        }
+        int32_t gain = (out << STICK_GAIN_SHIFT) / in;
+        table->gains[k] = gain > 0xFFFF ? 0xFFFF : gain;
+    }
+}
+
+void stickBuildTable(uint8_t player)
+{
+    buildTable(&config.stick[player], &tables[player]);
+}
+
+void stickBegin()
+{
+    for (uint8_t i = 0; i < MAX_CONTROLLERS; i++)
+        stickBuildTable(i);
+    buildTable(&aimConfig, &aimTable);
+    stickSetAimSensitivity(config.sbSensitivity);
+}
+
+//Gain for a deflection outside the deadzone
+static inline uint16_t gainAt(const StickTable_t *table, uint16_t m)
+{
+    uint16_t pos = ((uint32_t)(m - table->deadzone) * table->step) >> 8; //In 256ths of a table step
+    uint8_t i = pos >> 8;
+    if (i >= STICK_TABLE_SIZE - 1)
+        return table->gains[STICK_TABLE_SIZE - 1];
+    uint16_t a = table->gains[i];
+    uint16_t b = table->gains[i + 1];
+    uint8_t frac = pos;
+    if (b >= a)
+        return a + (uint16_t)(((uint32_t)(b - a) * frac) >> 8);
+    return a - (uint16_t)(((uint32_t)(a - b) * frac) >> 8);
+}
+
+static inline uint16_t magnitude(int16_t v)
+{
+    return v < 0 ? (v == -32768 ? 32767 : -v) : v;
+}
+
+static inline int16_t scale(int16_t v, uint16_t gain)
+{
+    int32_t out = ((int32_t)v * gain) >> STICK_GAIN_SHIFT;
+    if (out > 32767)
+        return 32767;
+    if (out < -32768)
+        return -32768;
+    return out;
+}
+
+static inline int16_t shapeAxis(const StickTable_t *table, int16_t v)
+{
+    uint16_t m = magnitude(v);
+    if (m <= table->deadzone)
+        return 0;
+    return scale(v, gainAt(table, m));
+}
+
+//Shape one stick of a player in place.
+void stickApply(uint8_t player, int16_t *x, int16_t *y)
+{
+    const StickTable_t *table = &tables[player];
+    if (config.stick[player].flags & STICK_AXIAL)
+    {
+        *x = shapeAxis(table, *x);
+        *y = shapeAxis(table, *y);
+        return;
+    }
+
+    uint16_t ax = magnitude(*x);
+    uint16_t ay = magnitude(*y);
+    uint16_t hi = ax > ay ? ax : ay;
+    uint16_t lo = ax > ay ? ay : ax;
+    uint32_t m = hi + (lo >> 1);
+    m -= m >> 4;
+    if (m > 32767)
+        m = 32767;
+    if (m <= table->deadzone)
+    {
+        *x = 0;
+        *y = 0;
+        return;
+    }
+    uint16_t gain = gainAt(table, m);
+    *x = scale(*x, gain);
+    *y = scale(*y, gain);
+}
+
+void stickSetAimSensitivity(uint16_t sensitivity)
+{
+    aimScale = 65535U / (sensitivity != 0 ? sensitivity : 1);
+}
+
+//How far the Steel Battalion aiming cursor moves every SB_AIM_PERIOD ms for an aiming stick axis,
+//in 256ths of a count. Worked out on the magnitude so both directions move the same.
+int32_t stickAimStep(int16_t axis)
+{
+    uint16_t m = magnitude(axis);
+    if (m <= aimTable.deadzone)
+        return 0;
+    uint32_t shaped = ((uint32_t)m * gainAt(&aimTable, m)) >> STICK_GAIN_SHIFT;
+    if (shaped > STICK_MAX)
+        shaped = STICK_MAX;
+    int32_t step = (shaped * aimScale) >> 8;
+    return axis < 0 ? -step : step;
+}
+
+//Cycles it takes to shape one stick, measured on a stick pushed part way.
+uint16_t stickBenchmark()
+{
+    int16_t x = 12345, y = -23456;
+    uint32_t start = halMicros();
+    for (uint8_t i = 0; i < 64; i++)
+    {
+        int16_t sx = x, sy = y;
+        stickApply(0, &sx, &sy);
+        __asm__ volatile("" ::"r"(sx), "r"(sy));
+    }
+    //micros() only counts in 4us steps, so time 64 calls and divide it out
+    return (uint32_t)(halMicros() - start) * (F_CPU / 1000000UL) / 64;
+}
+#endif
@@ -0,0 +1,40 @@
+/*
+ * stick.h
+ *
+ * Analog stick shaping: deadzone, anti-deadzone and response curve.
+ *
+ * Each player has a table of STICK_TABLE_SIZE gains (output / input) spread evenly over the
+ * travel outside the deadzone, built from their StickConfig_t by stickBuildTable() whenever it
+ * changes. Shaping a stick is then a table lookup with interpolation between two entries and a
+ * multiply by the gain, with shifts for the fixed point scaling. There is no division on the hot
+ * path.
+ *
+ * A radial deadzone works on the length of the stick vector, estimated as
+ * 15/16 * (max + min/2) of the two axes, and scales both axes by the same gain so the direction
+ * is kept. With STICK_AXIAL each axis is shaped on its own.
+ */
+
+#ifndef STICK_H_
+#define STICK_H_
+#include <inttypes.h>
+#include "settings.h"
+
+#define STICK_CURVE_LINEAR 0
+#define STICK_CURVE_SOFT 1       //Finer control near the centre, t^1.5
+#define STICK_CURVE_QUADRATIC 2  //Much finer near the centre, t^2
+#define STICK_CURVE_AGGRESSIVE 3 //Fast response off centre, sqrt(t)
+#define STICK_CURVES 4
+
+#define STICK_AXIAL 0x01 //StickConfig_t flag, deadzone and curve per axis instead of on the vector
+
+#define STICK_TABLE_SIZE 17 //Gains at 0, 1/16 ... 16/16 of the travel outside the deadzone
+#define STICK_GAIN_SHIFT 12 //Gains are fixed point with 12 fraction bits
+
+void stickBegin();
+void stickBuildTable(uint8_t player);
+void stickApply(uint8_t player, int16_t *x, int16_t *y);
+void stickSetAimSensitivity(uint16_t sensitivity);
+int32_t stickAimStep(int16_t axis);
+uint16_t stickBenchmark();
+
+#endif /* STICK_H_ */
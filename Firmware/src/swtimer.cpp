@@ -0,0 +1,149 @@
+/*
+ * swtimer.cpp
+ *
+ * Software timer wheel. See swtimer.h.
+ */
+
+#include <stddef.h>
+#include "hal.h"
+#include "swtimer.h"
+#ifdef __AVR__
+#include <util/atomic.h>
+#include "Arduino.h"
+#endif
+
+#define TIMER_SLOT(tick) (&wheel[(tick) & (TIMER_WHEEL_SLOTS - 1)])
+
+static Timer_t *wheel[TIMER_WHEEL_SLOTS];
+static uint16_t lastTick; //Last tick timerTask() has handled
+
+#ifdef __AVR__
+static volatile uint16_t ticks;
+
+ISR(TIMER3_COMPA_vect)
+{
+    ticks++;
+}
+
+//Start the 1ms tick on Timer3. Timer0 stays with the Arduino core for millis() and delay().
+void timerBegin()
+{
+    TCCR3A = 0;
+    TCCR3B = _BV(WGM32) | _BV(CS31) | _BV(CS30); //CTC mode, clk/64
+    OCR3A = (F_CPU / 64 / 1000) - 1;
+    TIMSK3 |= _BV(OCIE3A);
+    lastTick = timerNow();
+}
+
+uint16_t timerNow()
+{
+    uint16_t now;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        now = ticks;
+    }
+    return now;
+}
+#else
+//Off target the ticks are the milliseconds of the HAL's virtual time.
+void timerBegin()
+{
+    lastTick = timerNow();
+}
+
+uint16_t timerNow()
+{
+    return (uint16_t)halMillis();
+}
+#endif
+
+static void timerLink(Timer_t *t)
+{
+    Timer_t **slot = TIMER_SLOT(t->due);
+    t->next = *slot;
+    *slot = t;
+}
+
+static void timerUnlink(Timer_t *t)
+{
+    for (Timer_t **link = TIMER_SLOT(t->due); *link != NULL; link = &(*link)->next)
+    {
+        if (*link == t)
+        {
+            *link = t->next;
+            return;
+        }
+    }
+}
+
+//Call callback(arg) delay ms from now, then every period ms if period is not 0.
+//Starting a timer that is already running starts it again from now.
+void timerStart(Timer_t *t, uint16_t delay, uint16_t period, TimerCallback callback, uint8_t arg)
+{
+    if (t->active)
+        timerUnlink(t);
+    t->due = timerNow() + (delay != 0 ? delay : 1);
+    t->period = period;
+    t->callback = callback;
+    t->arg = arg;
+    t->active = true;
+    timerLink(t);
+}
+
+void timerStop(Timer_t *t)
+{
+    if (!t->active)
+        return;
+    timerUnlink(t);
+    t->active = false;
+}
+
+bool timerActive(const Timer_t *t)
+{
+    return t->active;
+}
+
+//Run the callbacks of the timers that are due. Call this from the main loop.
+void timerTask()
+{
+    //A callback can end up back in here, e.g. through the USB host enumeration hook.
+    static bool running = false;
+    if (running)
+        return;
+    running = true;
+
+    uint16_t now = timerNow();
+    while (lastTick != now)
+    {
+        lastTick++;
+        Timer_t **link = TIMER_SLOT(lastTick);
+        while (*link != NULL)
+        {
+            Timer_t *t = *link;
+            if (t->due != lastTick)
+            {
+                link = &t->next; //Due on a later turn of the wheel
+                continue;
+            }
+
+            *link = t->next;
+            if (t->period != 0)
+            {
+                //After a stall the periods that were missed are skipped, not fired one after another.
+                //The timer keeps its phase.
+                t->due += t->period;
+                if ((int16_t)(t->due - now) <= 0)
+                    t->due += ((uint16_t)(now - t->due) / t->period + 1) * t->period;
+                timerLink(t);
+            }
+            else
+            {
+                t->active = false;
+            }
+            t->callback(t->arg);
+            //The callback may have started or stopped timers in this slot, look at it again.
+            link = TIMER_SLOT(lastTick);
+        }
+    }
+    running = false;
+}
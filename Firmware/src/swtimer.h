@@ -0,0 +1,39 @@
+/*
+ * swtimer.h
+ *
+ * Software timers driven by a 1ms Timer3 tick.
+ *
+ * A Timer_t belongs to its caller and sits in a timer wheel of TIMER_WHEEL_SLOTS lists while
+ * it is running, in the slot for the tick it is due on. The Timer3 interrupt only counts ticks.
+ * timerTask() in the main loop catches up on the ticks since it last ran and looks at one slot
+ * per tick, so a pass where no tick has elapsed costs nothing and only the timers that could be
+ * due in that millisecond are looked at. Callbacks run from timerTask(), never from the interrupt.
+ * A periodic timer fires once for a stall longer than its period, the periods missed are skipped.
+ */
+
+#ifndef SWTIMER_H_
+#define SWTIMER_H_
+#include <inttypes.h>
+
+#define TIMER_WHEEL_SLOTS 16 //Must be a power of two
+
+typedef void (*TimerCallback)(uint8_t arg);
+
+typedef struct Timer
+{
+    struct Timer *next;
+    uint16_t due;    //Tick the timer fires on
+    uint16_t period; //Ticks between calls, 0 for a one shot timer
+    TimerCallback callback;
+    uint8_t arg;     //Passed to the callback, e.g. the controller number
+    bool active;
+} Timer_t;
+
+void timerBegin();
+uint16_t timerNow();
+void timerStart(Timer_t *t, uint16_t delay, uint16_t period, TimerCallback callback, uint8_t arg);
+void timerStop(Timer_t *t);
+bool timerActive(const Timer_t *t);
+void timerTask();
+
+#endif /* SWTIMER_H_ */
@@ -0,0 +1,281 @@
+/*
+ * twimaster.cpp
+ *
+ * Interrupt driven TWI master. See twimaster.h.
+ *
+ * The queue is a ring with three free running indices:
+ *   qTail..qTx  finished, waiting for twiTask() to run their callback
+ *   qTx         on the bus
+ *   qTx..qHead  waiting to be sent
+ * Only the interrupt moves qTx, only the main loop moves qHead and qTail.
+ *
+ * With twiListen() the master also answers its own address, so slaves can take the bus and
+ * write to it. Only one received frame is held at a time. Until twiTask() has passed it on,
+ * the own address is not acknowledged and the slave tries again later.
+ */
+
+#include "settings.h"
+#ifdef MASTER
+#include <string.h>
+#include <util/atomic.h>
+#include <util/twi.h>
+#include "Arduino.h"
+#include "twimaster.h"
+
+typedef struct
+{
+    uint8_t addr;    //Slave address in bits 1-7, TW_READ or TW_WRITE in bit 0
+    uint8_t len;
+    uint8_t status;
+    uint16_t time;   //micros() when queued, how long it took once finished
+    TwiCallback done;
+    uint8_t data[TWI_MAX_DATA];
+} TwiTransfer_t;
+
+#define TWI_ENTRY(n) (&queue[(n) & (TWI_QUEUE_LEN - 1)])
+#define TWI_GO (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+
+static TwiTransfer_t queue[TWI_QUEUE_LEN];
+static volatile uint8_t qHead;
+static volatile uint8_t qTx;
+static uint8_t qTail;
+static volatile bool busy;
+static volatile uint16_t txStart; //micros() when the transfer on the bus was started
+static uint8_t txIndex;           //Next byte of the transfer on the bus
+static TwiStats_t stats;
+
+static TwiCallback rxDone;
+static volatile uint8_t rxAck; //_BV(TWEA) while the own address is answered
+static volatile bool rxReady;  //rxBuffer holds a frame for twiTask()
+static uint8_t rxBuffer[TWI_MAX_DATA];
+static uint8_t rxIndex;
+static uint8_t rxLen;
+
+//Finish the transfer on the bus and start the next one. ctrl is _BV(TWSTO) to end with a stop
+//condition, or 0 to just release the bus. Called from the interrupt or with interrupts off.
+static void twiFinish(uint8_t status, uint8_t ctrl)
+{
+    TwiTransfer_t *t = TWI_ENTRY(qTx);
+    t->status = status;
+    t->time = (uint16_t)micros() - t->time;
+    qTx++;
+
+    if (qTx != qHead)
+    {
+        //The hardware sends the stop then the start as soon as the bus is free.
+        txIndex = 0;
+        txStart = micros();
+        TWCR = TWI_GO | rxAck | _BV(TWSTA) | ctrl;
+    }
+    else
+    {
+        busy = false;
+        TWCR = TWI_GO | rxAck | ctrl;
+    }
+}
+
+ISR(TWI_vect)
+{
+    TwiTransfer_t *t = TWI_ENTRY(qTx);
+    switch (TW_STATUS)
+    {
+    case TW_START:
+    case TW_REP_START:
+        TWDR = t->addr;
+        TWCR = TWI_GO | rxAck;
+        break;
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (txIndex < t->len)
+        {
+            TWDR = t->data[txIndex++];
+            TWCR = TWI_GO | rxAck;
+        }
+        else
+        {
+            twiFinish(TWI_OK, _BV(TWSTO));
+        }
+        break;
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+        twiFinish(TWI_NACK_ADDR, _BV(TWSTO));
+        break;
+    case TW_MT_DATA_NACK:
+        twiFinish(TWI_NACK_DATA, _BV(TWSTO));
+        break;
+    case TW_MR_SLA_ACK:
+        //ACK every byte but the last one
+        TWCR = TWI_GO | (t->len > 1 ? _BV(TWEA) : 0);
+        break;
+    case TW_MR_DATA_ACK:
+        t->data[txIndex++] = TWDR;
+        TWCR = TWI_GO | (txIndex + 1 < t->len ? _BV(TWEA) : 0);
+        break;
+    case TW_MR_DATA_NACK:
+        t->data[txIndex++] = TWDR;
+        twiFinish(TWI_OK, _BV(TWSTO));
+        break;
+    case TW_MT_ARB_LOST: //Same as TW_MR_ARB_LOST
+        //A slave took the bus, send the whole transfer again once it is free.
+        txIndex = 0;
+        TWCR = TWI_GO | rxAck | _BV(TWSTA);
+        break;
+    case TW_SR_ARB_LOST_SLA_ACK:
+        txIndex = 0; //The transfer we were sending is started again after the stop
+        //fall through
+    case TW_SR_SLA_ACK:
+        rxIndex = 0;
+        TWCR = TWI_GO | _BV(TWEA);
+        break;
+    case TW_SR_DATA_ACK:
+        rxBuffer[rxIndex++] = TWDR;
+        TWCR = TWI_GO | (rxIndex < TWI_MAX_DATA ? _BV(TWEA) : 0);
+        break;
+    case TW_SR_DATA_NACK:
+        //Too long for rxBuffer, drop the frame. No stop follows for us, so restart our own
+        //transfer from here.
+        rxIndex = 0xFF;
+        TWCR = TWI_GO | rxAck | (busy ? _BV(TWSTA) : 0);
+        break;
+    case TW_SR_STOP:
+        if (rxIndex != 0xFF)
+        {
+            rxLen = rxIndex;
+            rxReady = true;
+            rxAck = 0; //Hold off the next frame until twiTask() has taken this one
+        }
+        TWCR = TWI_GO | rxAck | (busy ? _BV(TWSTA) : 0);
+        break;
+    default: //TW_BUS_ERROR. Setting TWSTO here only releases the lines, no stop is sent.
+        twiFinish(TWI_BUS_ERROR, _BV(TWSTO));
+        break;
+    }
+}
+
+void twiBegin(uint32_t clock)
+{
+    //Internal pull ups on SDA and SCL, same as Wire.begin()
+    digitalWrite(SDA, HIGH);
+    digitalWrite(SCL, HIGH);
+    TWSR = 0; //Prescaler 1
+    TWBR = ((F_CPU / clock) - 16) / 2;
+    TWCR = _BV(TWEN) | _BV(TWIE);
+}
+
+//Answer addr as a slave. done is called from twiTask() with each frame written to it.
+void twiListen(uint8_t addr, TwiCallback done)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        rxDone = done;
+        rxAck = _BV(TWEA);
+        TWAR = addr << 1;
+        if (!busy)
+            TWCR = _BV(TWEN) | _BV(TWIE) | rxAck;
+    }
+}
+
+//Reserve the next free entry, or NULL if the queue is full.
+static TwiTransfer_t *twiReserve(uint8_t addr, uint8_t len, TwiCallback done)
+{
+    if ((uint8_t)(qHead - qTail) >= TWI_QUEUE_LEN || len == 0 || len > TWI_MAX_DATA)
+    {
+        stats.overflows++;
+        return NULL;
+    }
+    TwiTransfer_t *t = TWI_ENTRY(qHead);
+    t->addr = addr;
+    t->len = len;
+    t->done = done;
+    t->time = micros();
+    return t;
+}
+
+//Hand the reserved entry to the interrupt, and start the bus if it is idle.
+static void twiSubmit()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        qHead++;
+        if (!busy)
+        {
+            busy = true;
+            txIndex = 0;
+            txStart = micros();
+            TWCR = TWI_GO | rxAck | _BV(TWSTA);
+        }
+    }
+    stats.depth = qHead - qTail;
+    if (stats.depth > stats.maxDepth)
+        stats.maxDepth = stats.depth;
+}
+
+//Queue len bytes of data to be written to a slave. The data is copied.
+//Returns false if the queue is full, the transfer is not sent and done is not called.
+bool twiWrite(uint8_t addr, const uint8_t *data, uint8_t len, TwiCallback done)
+{
+    TwiTransfer_t *t = twiReserve((addr << 1) | TW_WRITE, len, done);
+    if (t == NULL)
+        return false;
+    memcpy(t->data, data, len);
+    twiSubmit();
+    return true;
+}
+
+//Queue a read of len bytes from a slave. The bytes are passed to done.
+//Returns false if the queue is full.
+bool twiRead(uint8_t addr, uint8_t len, TwiCallback done)
+{
+    if (twiReserve((addr << 1) | TW_READ, len, done) == NULL)
+        return false;
+    twiSubmit();
+    return true;
+}
+
+//Run the callbacks of finished transfers and received frames. Call this from the main loop.
+void twiTask()
+{
+    //A slave that is reset in the middle of a transfer can hold the bus forever. Give up on the
+    //transfer and reset the TWI hardware, which lets go of the lines.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (busy && (uint16_t)micros() - txStart > TWI_TIMEOUT)
+        {
+            TWCR = 0;
+            twiFinish(TWI_TIMEOUT_ERROR, 0);
+        }
+    }
+
+    while (qTail != qTx)
+    {
+        TwiTransfer_t *t = TWI_ENTRY(qTail);
+        stats.lastTime = t->time;
+        if (t->time > stats.maxTime)
+            stats.maxTime = t->time;
+        if (t->status != TWI_OK)
+            stats.errors++;
+        if (t->done != NULL)
+            t->done(t->addr >> 1, t->status, t->data, t->len);
+        qTail++;
+    }
+    stats.depth = qHead - qTail;
+
+    if (rxReady)
+    {
+        rxDone(TWAR >> 1, TWI_OK, rxBuffer, rxLen);
+        stats.received++;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            rxReady = false;
+            rxAck = _BV(TWEA);
+            if (!busy)
+                TWCR = _BV(TWEN) | _BV(TWIE) | rxAck;
+        }
+    }
+}
+
+TwiStats_t *twiGetStats()
+{
+    return &stats;
+}
+#endif
@@ -0,0 +1,50 @@
+/*
+ * twimaster.h
+ *
+ * Interrupt driven TWI (I2C) master used by the master device to talk to the slave devices.
+ *
+ * Transfers are put in a queue and sent by the TWI interrupt one after the other, so the
+ * main loop never waits on the bus. When a transfer has finished its callback is run from
+ * twiTask() in the main loop, not from the interrupt, so it can touch any state it likes.
+ *
+ * The bus can have more than one master. A transfer that loses arbitration is sent again,
+ * and twiListen() lets other masters write frames to this device.
+ */
+
+#ifndef TWIMASTER_H_
+#define TWIMASTER_H_
+#include <inttypes.h>
+#include "settings.h"
+
+#define TWI_QUEUE_LEN 8  //Must be a power of two. Room for a state frame and an actuator read for each slave
+#define TWI_MAX_DATA 32  //Big enough for the largest link frame
+#define TWI_TIMEOUT 2000 //us, a transfer that takes longer than this has hung the bus
+
+//Transfer status passed to the callback
+#define TWI_OK 0
+#define TWI_NACK_ADDR 1 //No slave at this address
+#define TWI_NACK_DATA 2 //The slave stopped accepting data
+#define TWI_BUS_ERROR 3 //Illegal start or stop condition
+#define TWI_TIMEOUT_ERROR 4
+
+typedef void (*TwiCallback)(uint8_t addr, uint8_t status, const uint8_t *data, uint8_t len);
+
+typedef struct
+{
+    uint8_t depth;      //Transfers waiting, on the bus or waiting for their callback
+    uint8_t maxDepth;   //Deepest the queue has been
+    uint16_t overflows; //Transfers that could not be queued because the queue was full
+    uint16_t errors;    //Transfers that did not finish with TWI_OK
+    uint16_t lastTime;  //us from queueing to completion of the last transfer
+    uint16_t maxTime;   //Longest queueing to completion time seen
+    uint16_t received;  //Frames written to the address passed to twiListen()
+} TwiStats_t;
+
+void twiBegin(uint32_t clock);
+void twiListen(uint8_t addr, TwiCallback done);
+bool twiWrite(uint8_t addr, const uint8_t *data, uint8_t len, TwiCallback done);
+bool twiRead(uint8_t addr, uint8_t len, TwiCallback done);
+void twiTask();
+TwiStats_t *twiGetStats();
+
+#endif /* TWIMASTER_H_ */
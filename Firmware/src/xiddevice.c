@@ -28,9 +28,11 @@ arising out of or in connection with the use or performance of
 this software.
 */
 
+#include <string.h>
 #include "settings.h"
 #include "xiddevice.h"
 #include "dukecontroller.h"
+#include "ramwatch.h"
 
 #ifdef SUPPORTBATTALION
 #include "steelbattalion.h"
@@ -184,6 +186,18 @@ void EVENT_USB_Device_ControlRequest(void)
         }
     }
 
+    //Not an XID request, the console never sends it. Lets a PC read how much SRAM is left.
+    if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE) &&
+        USB_ControlRequest.bRequest == RAM_VENDOR_REQUEST)
+    {
+        RamStats_t stats;
+        ramGetStats(&stats);
+        Endpoint_ClearSETUP();
+        Endpoint_Write_Control_Stream_LE(&stats, sizeof(stats));
+        Endpoint_ClearOUT();
+        return;
+    }
+
     //If the request is a standard HID control request, jump into the LUFA library to handle it for us.
     switch (ConnectedXID)
     {
@@ -271,6 +285,37 @@ bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t *const HIDIn
     return false;
 }
 
+/* Load the Duke report into the IN endpoint now, rather than waiting for the next
+*  HID_Device_USBTask() poll. The report is also stored as the previous report, so
+*  HID_Device_USBTask() won't send it a second time. Returns false if the endpoint
+*  bank still holds a report the host has not read yet. */
+bool DukeController_SendReport(void)
+{
+    USB_ClassInfo_HID_Device_t *HIDInterfaceInfo = &DukeController_HID_Interface;
+    uint8_t ReportID = 0;
+    uint16_t ReportINSize = 0;
+    bool Sent = false;
+
+    if (USB_DeviceState != DEVICE_STATE_Configured || ConnectedXID != DUKE_CONTROLLER)
+        return false;
+
+    uint8_t PrevEndpoint = Endpoint_GetCurrentEndpoint();
+    Endpoint_SelectEndpoint(HIDInterfaceInfo->Config.ReportINEndpoint.Address);
+    if (Endpoint_IsReadWriteAllowed())
+    {
+        memset(&PrevDukeHIDReportBuffer, 0, sizeof(PrevDukeHIDReportBuffer));
+        CALLBACK_HID_Device_CreateHIDReport(HIDInterfaceInfo, &ReportID, HID_REPORT_ITEM_In,
+                                            &PrevDukeHIDReportBuffer, &ReportINSize);
+        Endpoint_Write_Stream_LE(&PrevDukeHIDReportBuffer, ReportINSize, NULL);
+        Endpoint_ClearIN();
+        HIDInterfaceInfo->State.IdleMSRemaining = HIDInterfaceInfo->State.IdleCount;
+        HIDInterfaceInfo->State.PrevFrameNum = USB_Device_GetFrameNumber();
+        Sent = true;
+    }
+    Endpoint_SelectEndpoint(PrevEndpoint);
+    return Sent;
+}
+
 /* HID class driver callback for the user processing of a received HID OUT report. This callback may fire in response to
 *  either HID class control requests from the host, or by the normal HID endpoint polling procedure. Inside this callback
 *  the user is responsible for the processing of the received HID output report from the host.*/
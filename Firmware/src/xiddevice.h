@@ -73,6 +73,7 @@ extern "C"
                                               const uint8_t ReportType,
                                               const void *ReportData,
                                               const uint16_t ReportSize);
+    bool DukeController_SendReport(void);
 
     /* Data Types: */
     extern USB_ClassInfo_HID_Device_t DukeController_HID_Interface;